@@ -26,17 +26,71 @@
  * $FreeBSD$
  */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <string>
 
 #include "add_testcase.h"
 
+/*
+ * Returns the arguments of atf_check(1) verifying the exit status
+ * (or the terminating signal), the stdout and the stderr of "output".
+ * The stderr of a failed command is matched against "$usage_output"
+ * if "usage_output" is set. A stream which was truncated while being
+ * captured is ignored, as its contents are not known in entirety.
+ */
+std::string
+addtestcase::Checks(const utils::ProbeResult& output, bool usage_output)
+{
+	std::string checks;
+
+	if (output.termsig)
+		checks = "-s signal:" + std::to_string(output.termsig) + " -o ";
+	else
+		checks = "-s exit:" + std::to_string(output.exitstatus) + " -o ";
+
+	if (output.outsize > output.out.size())
+		checks.append("ignore -e ");
+	else if (!output.out.empty())
+		checks.append("inline:\"" + output.out + "\" -e ");
+	else
+		checks.append("empty -e ");
+
+	/* Check if a usage message was produced (case-insensitive match). */
+	if (output.errsize > output.err.size())
+		checks.append("ignore ");
+	else if (output.err.empty())
+		checks.append("empty ");
+	else if (usage_output && !output.Succeeded())
+		checks.append("match:\"$usage_output\" ");
+	else
+		checks.append("inline:\"" + output.err + "\" ");
+
+	return checks;
+}
+
+/*
+ * Returns the name of the testcase of "option", e.g. "h_flag" for '-h'
+ * and "long_dry_run_flag" for '--dry-run' (see utils::CheckOpts()), as
+ * a '-' can't be a part of the name of a shell function.
+ */
+std::string
+addtestcase::TestcaseName(std::string option)
+{
+	if (option.size() < 2 || option[0] != '-')
+		return option + "_flag";
+
+	std::replace(option.begin(), option.end(), '-', '_');
+	return "long" + option + "_flag";
+}
+
 /* Adds a test-case for an option with known usage. */
 void
 addtestcase::KnownTestcase(std::string option,
 			   std::string util_with_section,
 			   std::string descr,
-			   std::string output,
+			   const utils::ProbeResult& output,
 			   std::ofstream& test_script)
 {
 	std::string testcase_name;
@@ -45,10 +99,9 @@ addtestcase::KnownTestcase(std::string option,
 
 	/* Add testcase name. */
 	test_script << "atf_test_case ";
-	if (!option.empty()) {
-		testcase_name = option;
-		testcase_name.append("_flag");
-	} else
+	if (!option.empty())
+		testcase_name = TestcaseName(option);
+	else
 		testcase_name = "no_arguments";
 	test_script << testcase_name + "\n";
 
@@ -59,19 +112,14 @@ addtestcase::KnownTestcase(std::string option,
 		test_script << descr;
 	else
 		test_script << "\"Verify the usage of option \'"
-			     + option + "\'\"";
+			     + (option.size() > 1 && option[0] == '-' ?
+				"-" + option : option)
+			     + "\'\"";
 	test_script << "\n}\n\n";
 
 	/* Add body of the testcase. */
 	test_script << testcase_name + "_body()\n{"
-		     + "\n\tatf_check -s exit:0 -o ";
-
-	/* Match the usage output if generated. */
-	if (!output.empty())
-		test_script << "inline:\"" + output + "\" ";
-	else
-		test_script << "empty ";
-	test_script << utility;
+		     + "\n\tatf_check " + Checks(output, false) + utility;
 
 	if (!option.empty())
 		test_script << " -" + option;
@@ -82,27 +130,15 @@ addtestcase::KnownTestcase(std::string option,
 void
 addtestcase::UnknownTestcase(std::string option,
 			     std::string util_with_section,
-			     std::pair<std::string, int> output,
+			     const utils::ProbeResult& output,
 			     std::string& testcase_buffer,
 			     bool usage_output)
 {
 	std::string utility = util_with_section.substr(0,
 			      util_with_section.size() - 3);
 
-	if (output.second)
-		testcase_buffer.append("\n\tatf_check -s not-exit:0 -e ");
-	else
-		testcase_buffer.append("\n\tatf_check -s exit:0 -o ");
-
-	/* Check if a usage message was produced (case-insensitive match). */
-	if (usage_output)
-		testcase_buffer.append("match:\"$usage_output\" ");
-	else if (!output.first.empty())
-		testcase_buffer.append("inline:\"" + output.first + "\" ");
-	else
-		testcase_buffer.append("empty ");
-
-	testcase_buffer.append(utility);
+	testcase_buffer.append("\n\tatf_check " + Checks(output, usage_output)
+			       + utility);
 
 	if (!option.empty())
 		testcase_buffer.append(" -" + option);
@@ -111,7 +147,7 @@ addtestcase::UnknownTestcase(std::string option,
 /* Adds a test-case for usage without any arguments. */
 void
 addtestcase::NoArgsTestcase(std::string util_with_section,
-			    std::pair<std::string, int> output,
+			    const utils::ProbeResult& output,
 			    std::ofstream& test_script,
 			    bool usage_output)
 {
@@ -119,11 +155,11 @@ addtestcase::NoArgsTestcase(std::string util_with_section,
 	std::string utility = util_with_section.substr(0,
 			      util_with_section.size() - 3);
 
-	if (output.second) {
+	if (!output.Succeeded()) {
 		/* An error was encountered. */
 		test_script << std::string("atf_test_case no_arguments\n")
 			     + "no_arguments_head()\n{\n\tatf_set \"descr\" ";
-		if (!output.first.empty()) {
+		if (!output.out.empty() || !output.err.empty()) {
 			/*
 			 * We expect a usage message to be generated in this
 			 * case (case-insensitive match).
@@ -136,8 +172,8 @@ addtestcase::NoArgsTestcase(std::string util_with_section,
 
 				test_script << descr
 					+ "\n}\n\nno_arguments_body()\n{"
-					+ "\n\tatf_check -s not-exit:0 -e match:"
-					+ "\"$usage_output\" " + utility;
+					+ "\n\tatf_check " + Checks(output, true)
+					+ utility;
 			} else {
 				descr = "\"Verify that " + util_with_section
 				      + " fails and generates a valid output \" "
@@ -145,15 +181,14 @@ addtestcase::NoArgsTestcase(std::string util_with_section,
 
 				test_script << descr
 					+ "\n}\n\nno_arguments_body()\n{"
-					+ "\n\tatf_check -s not-exit:0 -e inline:"
-					+ "\"" + output.first + "\" "
+					+ "\n\tatf_check " + Checks(output, false)
 					+ utility;
 			}
 		} else {
 			descr = "\"Verify that " + util_with_section + " fails "
 			      + "silently when no arguments are supplied\"" ;
 			test_script << descr + "\n}\n\nno_arguments_body()\n{"
-				     + "\n\tatf_check -s not-exit:0 -e empty "
+				     + "\n\tatf_check " + Checks(output, false)
 				     + utility;
 		}
 		test_script << "\n}\n\n";
@@ -162,7 +197,7 @@ addtestcase::NoArgsTestcase(std::string util_with_section,
 		 * The command ran successfully, hence we guessed
 		 * a correct usage for the utility under test.
 		 */
-		if (!output.first.empty())
+		if (!output.out.empty())
 			descr = "\"Verify that " + util_with_section + " executes "
 			      + "successfully and produces a valid \" \\\n\t\t\t"
 			      + "\"output when invoked without any arguments\"";
@@ -172,6 +207,6 @@ addtestcase::NoArgsTestcase(std::string util_with_section,
 			      + "\t\t\t\"when invoked without any arguments\"";
 
 		addtestcase::KnownTestcase("", util_with_section, descr,
-					   output.first, test_script);
+					   output, test_script);
 	}
 }
@@ -29,14 +29,20 @@
 #ifndef _ADD_TESTCASE_H_
 #define _ADD_TESTCASE_H_
 
+#include "utils.h"
+
 namespace addtestcase {
+	std::string Checks(const utils::ProbeResult&, bool);
+
+	std::string TestcaseName(std::string);
+
 	void KnownTestcase(std::string, std::string, std::string, \
-			   std::string, std::ofstream&);
+			   const utils::ProbeResult&, std::ofstream&);
 
-	void UnknownTestcase(std::string, std::string, std::pair<std::string, int>, \
+	void UnknownTestcase(std::string, std::string, const utils::ProbeResult&, \
 			     std::string&, bool);
 
-	void NoArgsTestcase(std::string, std::pair<std::string, int>, \
+	void NoArgsTestcase(std::string, const utils::ProbeResult&, \
 			    std::ofstream&, bool);
 }
 
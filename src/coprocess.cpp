@@ -0,0 +1,390 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "coprocess.h"
+#include "logging.h"
+#include "scratch.h"
+#include "utils.h"
+
+#define READ 0  	/* Pipe descriptor: read end. */
+#define WRITE 1 	/* Pipe descriptor: write end. */
+#define BUFSIZE (64 * 1024)
+/* Descriptor of the shell over which the pid and status are reported. */
+#define CTLFD 3
+
+bool coprocess::enabled = false;
+
+/* State of the shell coprocess of the current process. */
+static struct {
+	pid_t owner;   /* Process owning the coprocess. */
+	pid_t pid;     /* PID of the shell. */
+	int infd;      /* Write end of the shell's stdin. */
+	int outfd;     /* Read end of the shell's stdout. */
+	int errfd;     /* Read end of the shell's stderr. */
+	int ctlfd;     /* Read end of the shell's CTLFD. */
+	unsigned long ncommands;  /* Used for making the delimiters unique. */
+	scratch::Pool *dirs;  /* Scratch directories of the commands. */
+} shell = { -1, -1, -1, -1, -1, -1, 0, NULL };
+
+/* Quotes "str" as a single word for sh(1). */
+static std::string
+Quote(const std::string& str)
+{
+	std::string quoted = "'";
+
+	for (const auto &c : str) {
+		if (c == '\'')
+			quoted += "'\\''";
+		else
+			quoted.push_back(c);
+	}
+
+	return quoted + "'";
+}
+
+/*
+ * Closes the descriptors of the coprocess, and kills and reaps it if
+ * it's ours. Returns the status of the coprocess (see waitpid(2)), or
+ * -1 if it couldn't be retrieved.
+ */
+static int
+Stop()
+{
+	int fd[] = { shell.infd, shell.outfd, shell.errfd, shell.ctlfd };
+	int pstat = -1;
+
+	for (const auto &i : fd) {
+		if (i != -1)
+			close(i);
+	}
+	if (shell.owner == getpid() && shell.pid != -1) {
+		kill(-shell.pid, SIGKILL);
+		while (waitpid(shell.pid, &pstat, 0) == -1 && errno == EINTR)
+			;
+	}
+	shell.pid = -1;
+	shell.infd = shell.outfd = shell.errfd = shell.ctlfd = -1;
+
+	return pstat;
+}
+
+/*
+ * Starts the shell coprocess of the current process, unless it is
+ * already running. The coprocess is placed in a process group of its
+ * own, which the commands executed by it are part of too.
+ */
+static bool
+Start()
+{
+	int pipes[4][2];
+	std::vector<char *> envp;
+	char *argv[] = { (char *)"sh", NULL };
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	std::string path;
+	int error;
+	int i;
+
+	if (shell.owner == getpid() && shell.pid != -1)
+		return true;
+
+	/* The coprocess of the parent (if any) isn't ours to use. */
+	Stop();
+	shell.owner = getpid();
+	/* Neither are its scratch directories (see utils::workdir). */
+	shell.dirs = &scratch::Pool::Shared(utils::workdir);
+
+	if ((path = utils::LookupUtility("sh")).empty())
+		return false;
+	for (i = 0; i < 4; i++) {
+		if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+			while (i--) {
+				close(pipes[i][READ]);
+				close(pipes[i][WRITE]);
+			}
+			return false;
+		}
+	}
+	for (const auto &i : utils::environment)
+		envp.push_back((char *)i.c_str());
+	envp.push_back(NULL);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipes[0][READ],
+					 STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipes[1][WRITE],
+					 STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipes[2][WRITE],
+					 STDERR_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipes[3][WRITE], CTLFD);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+
+	error = posix_spawn(&shell.pid, path.c_str(), &actions, &attr,
+			    argv, envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	close(pipes[0][READ]);
+	for (i = 1; i < 4; i++)
+		close(pipes[i][WRITE]);
+	shell.infd = pipes[0][WRITE];
+	shell.outfd = pipes[1][READ];
+	shell.errfd = pipes[2][READ];
+	shell.ctlfd = pipes[3][READ];
+	if (error) {
+		shell.pid = -1;
+		Stop();
+		errno = error;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Reads the data available on "fd" into "output", returning false
+ * if the coprocess has exited.
+ */
+static bool
+Read(int fd, std::string& output)
+{
+	char buffer[BUFSIZE];
+	ssize_t nread;
+
+	if ((nread = read(fd, buffer, sizeof(buffer))) > 0)
+		output.append(buffer, nread);
+
+	return nread > 0 || (nread == -1 && errno == EINTR);
+}
+
+/* Whether "str" ends with "suffix". */
+static bool
+EndsWith(const std::string& str, const std::string& suffix)
+{
+	return str.size() >= suffix.size() &&
+	       !str.compare(str.size() - suffix.size(), suffix.size(), suffix);
+}
+
+/*
+ * Accounts for the "len" bytes of "data" in "size" and "digest", while
+ * retaining them in "output" as long as it holds less than
+ * utils::max_output bytes.
+ */
+static void
+Capture(const char *data,
+	size_t len,
+	std::string& output,
+	size_t& size,
+	uint64_t& digest)
+{
+	size += len;
+	digest = utils::Hash(data, len, digest);
+	if (output.size() < utils::max_output)
+		output.append(data, std::min(len,
+			      utils::max_output - output.size()));
+}
+
+/*
+ * Reads the data available on "fd" (a stream of the coprocess) like
+ * Read(), except that only the last "held" bytes, which may turn out to
+ * be the delimiter, are kept in "pending" while those before are
+ * captured (see Capture()) as soon as they are read, so that a chatty
+ * command can't make the stream grow without bound.
+ */
+static bool
+Read(int fd,
+     size_t held,
+     std::string& pending,
+     std::string& output,
+     size_t& size,
+     uint64_t& digest)
+{
+	bool alive;
+
+	alive = Read(fd, pending);
+	if (pending.size() > held) {
+		Capture(pending.data(), pending.size() - held, output, size,
+			digest);
+		pending.erase(0, pending.size() - held);
+	}
+
+	return alive;
+}
+
+/*
+ * Executes the shell command "command" via the coprocess, inside a
+ * scratch directory of its own, with a wall-clock budget of "timeout"
+ * milliseconds. The command is executed in a subshell, whose exit
+ * status is reported on CTLFD, while the ends of its stdout and stderr
+ * are marked by delimiters unique to the command. On hitting the
+ * deadline, the whole process group of the coprocess is terminated
+ * (and killed after the grace period) and a new coprocess is started
+ * for the next command.
+ * The result is the same as that of executing the command via "sh -c"
+ * except that the resource usage of the command isn't known, that "$$"
+ * refers to the coprocess, and that the exit status is only known as
+ * "$?" of the subshell. The shell reports a command killed by a signal
+ * as 128 + signal, which is taken as such, hence a command exiting with
+ * a status in that range (e.g. 130) is reported as killed by the signal
+ * (e.g. SIGINT) instead.
+ */
+utils::ProbeResult
+coprocess::Execute(std::string command, long timeout)
+{
+	utils::ProbeResult output;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point deadline;
+	std::string script;
+	std::string delimiter;
+	std::string out;  /* The unaccounted end of stdout. */
+	std::string err;  /* The unaccounted end of stderr. */
+	std::string ctl;
+	std::string slot;  /* Scratch directory of the command. */
+	std::string dir;
+	char cwd[PATH_MAX];
+	struct pollfd pfd[3];
+	long long remaining;
+	bool exited = false;  /* Whether the coprocess has exited. */
+	bool killed = false;  /* Whether the grace period ran out. */
+	bool failed = false;  /* Whether the coprocess was lost track of. */
+	int pstat;
+	int i;
+
+	if (!Start()) {
+		logging::LogPerror("coprocess::Start()");
+		output.exitstatus = 127;
+		return output;
+	}
+
+	/* The shell resolves relative paths against its own cwd. */
+	dir = slot = shell.dirs->Acquire();
+	if (dir[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+		dir = std::string(cwd) + "/" + slot;
+	delimiter = "--smoketest-" + std::to_string(getpid()) + "-"
+		  + std::to_string(shell.ncommands++) + "--\n";
+	script = "( cd " + Quote(dir) + " && eval " + Quote(command)
+	       + " ) </dev/null\n"
+	       + "echo $? >&" + std::to_string(CTLFD) + "\n"
+	       + "printf %s " + Quote(delimiter) + "\n"
+	       + "printf %s " + Quote(delimiter) + " >&2\n";
+
+	start = std::chrono::steady_clock::now();
+	deadline = start + std::chrono::milliseconds(timeout);
+	if (write(shell.infd, script.data(), script.size()) !=
+	    (ssize_t)script.size())
+		exited = true;
+
+	pfd[0].fd = shell.outfd;
+	pfd[1].fd = shell.errfd;
+	pfd[2].fd = shell.ctlfd;
+	while (!exited && (!EndsWith(out, delimiter) ||
+	       !EndsWith(err, delimiter) || !EndsWith(ctl, "\n"))) {
+		remaining = std::chrono::duration_cast<std::chrono::milliseconds>
+			(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0 && !output.timedout) {
+			kill(-shell.pid, SIGTERM);
+			output.timedout = true;
+		}
+		if (remaining + utils::grace <= 0 && !killed) {
+			kill(-shell.pid, SIGKILL);
+			killed = true;
+		}
+		if (output.timedout)
+			remaining += utils::grace;
+		for (i = 0; i < 3; i++)
+			pfd[i].events = POLLIN;
+		if (poll(pfd, 3, killed ? -1 : std::max(remaining, 0LL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			/* The coprocess can't be waited for, start anew. */
+			logging::LogPerror("poll()");
+			failed = exited = true;
+			break;
+		}
+		if ((pfd[0].revents &&
+		     !Read(shell.outfd, delimiter.size(), out, output.out,
+			   output.outsize, output.outdigest)) ||
+		    (pfd[1].revents &&
+		     !Read(shell.errfd, delimiter.size(), err, output.err,
+			   output.errsize, output.errdigest)) ||
+		    (pfd[2].revents && !Read(shell.ctlfd, ctl)))
+			exited = true;
+	}
+	output.duration = std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::steady_clock::now() - start).count();
+	shell.dirs->Release(slot);
+
+	if (exited) {
+		/* The command took the coprocess down along with it. */
+		pstat = Stop();
+		if (pstat == -1 || failed)
+			output.exitstatus = -1;
+		else if (WIFSIGNALED(pstat))
+			output.termsig = WTERMSIG(pstat);
+		else
+			output.exitstatus = WEXITSTATUS(pstat);
+	} else {
+		/*
+		 * The shell reports a command killed by a signal as
+		 * 128 + signal, which can't be told apart from an exit
+		 * status in that range.
+		 */
+		output.exitstatus = atoi(ctl.c_str());
+		if (output.exitstatus > 128 && output.exitstatus < 128 + NSIG) {
+			output.termsig = output.exitstatus - 128;
+			output.exitstatus = 0;
+		}
+	}
+	/* Whatever is held back and isn't the delimiter is output too. */
+	if (!EndsWith(out, delimiter))
+		Capture(out.data(), out.size(), output.out, output.outsize,
+			output.outdigest);
+	if (!EndsWith(err, delimiter))
+		Capture(err.data(), err.size(), output.err, output.errsize,
+			output.errdigest);
+
+	return output;
+}
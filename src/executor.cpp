@@ -0,0 +1,608 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#ifdef __FreeBSD__
+#include <sys/event.h>
+#else
+#include <poll.h>
+#endif
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+#include "executor.h"
+#include "logging.h"
+#include "utils.h"
+#include "zygote.h"
+
+/*
+ * Buffer size (used for buffering output generated
+ * after executing the utility-specific command).
+ */
+#define BUFSIZE (64 * 1024)
+#define MAXEVENTS 64  /* Maximum number of events handled in one go. */
+
+#ifndef __FreeBSD__
+/*
+ * Without kqueue(2), exits of the children are noticed via SIGCHLD,
+ * which is converted to an event on a pipe (the "self-pipe trick").
+ */
+static int sigchld_pipe[2] = { -1, -1 };
+static struct sigaction old_sigchld;
+
+static void
+SigchldHandler(int /* signo */)
+{
+	int saved_errno = errno;
+
+	write(sigchld_pipe[1], "", 1);
+	errno = saved_errno;
+}
+#endif
+
+executor::Executor::Executor(size_t max_children)
+	: max_children(max_children ? max_children : 1), buffer(BUFSIZE),
+	  dirs(scratch::Pool::Shared(utils::workdir))
+{
+#ifdef __FreeBSD__
+	struct kevent kev;
+
+	if ((evfd = kqueue()) == -1) {
+		logging::LogPerror("kqueue()");
+		exit(EXIT_FAILURE);
+	}
+	/* Exits of the children spawned via the zygote (see Wait()). */
+	if (zygote::Running()) {
+		EV_SET(&kev, zygote::Channel(), EVFILT_READ, EV_ADD, 0, 0,
+		       (void *)0);
+		if (kevent(evfd, &kev, 1, NULL, 0, NULL) == -1)
+			logging::LogPerror("kevent()");
+	}
+#else
+	struct sigaction sa;
+
+	if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+		logging::LogPerror("pipe2()");
+		exit(EXIT_FAILURE);
+	}
+	evfd = sigchld_pipe[0];
+
+	sa.sa_handler = SigchldHandler;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, &old_sigchld);
+#endif
+}
+
+executor::Executor::~Executor()
+{
+#ifdef __FreeBSD__
+	close(evfd);
+#else
+	sigaction(SIGCHLD, &old_sigchld, NULL);
+	close(sigchld_pipe[0]);
+	close(sigchld_pipe[1]);
+	sigchld_pipe[0] = sigchld_pipe[1] = -1;
+#endif
+}
+
+/*
+ * Queues "command" for execution with a wall-clock budget of "timeout"
+ * milliseconds. The command is identified by "id" upon completion.
+ * Commands can also be submitted from the callback passed to Run().
+ */
+void
+executor::Executor::Submit(size_t id,
+			   const std::vector<std::string>& command,
+			   long timeout)
+{
+	queue.push_back({ id, command, timeout });
+}
+
+/*
+ * Executes all the submitted commands, invoking "callback" as and
+ * when each of them completes.
+ */
+void
+executor::Executor::Run(Callback callback)
+{
+	while (!queue.empty() || !children.empty()) {
+		StartPending(callback);
+		ReapZygote(callback);
+		if (!children.empty())
+			Wait(callback);
+	}
+	utils::ReapStrays();
+}
+
+/*
+ * Executes the queued commands until "max_children" of them are
+ * running, each inside a scratch directory of its own.
+ */
+void
+executor::Executor::StartPending(Callback& callback)
+{
+	utils::ProbeResult missing;
+	utils::PipeDescriptor *pipe_descr;
+	Child child;
+	std::string dir;
+#ifdef __FreeBSD__
+	struct kevent kev;
+#endif
+
+	if (queue.empty() || children.size() >= max_children)
+		return;
+	missing.exitstatus = 127;
+
+	while (!queue.empty() && children.size() < max_children) {
+		Request request = std::move(queue.front());
+		queue.pop_front();
+
+		dir = dirs.Acquire();
+		pipe_descr = utils::Spawn(request.command, dir);
+		if (pipe_descr == NULL)
+			dirs.Release(dir);
+		if (pipe_descr == NULL && errno == ENOENT) {
+			/* Mimic the shell for a missing utility. */
+			callback(request.id, missing);
+			continue;
+		} else if (pipe_descr == NULL) {
+			logging::LogPerror("utils::Spawn()");
+			exit(EXIT_FAILURE);
+		}
+
+		child.id = request.id;
+		child.command = utils::CommandString(request.command);
+		if (utils::memfd_capture) {
+			/* The outputs are collected once the child exits. */
+			child.outfd = child.errfd = -1;
+			child.outmem = pipe_descr->outfd;
+			child.errmem = pipe_descr->errfd;
+		} else {
+			fcntl(pipe_descr->outfd, F_SETFL, O_NONBLOCK);
+			fcntl(pipe_descr->errfd, F_SETFL, O_NONBLOCK);
+			child.outfd = pipe_descr->outfd;
+			child.errfd = pipe_descr->errfd;
+			child.outmem = child.errmem = -1;
+		}
+		child.pid = pipe_descr->pid;
+		child.dir = std::move(dir);
+		child.terminated = false;
+		child.killed = false;
+		child.start = std::chrono::steady_clock::now();
+		child.deadline = child.start
+			       + std::chrono::milliseconds(request.timeout);
+		child.output = utils::ProbeResult();
+		free(pipe_descr);
+
+#ifdef __FreeBSD__
+		/*
+		 * Watch the output pipes, the exit and the deadline of the
+		 * child. The pid of the child identifies its events.
+		 */
+		if (child.outfd != -1) {
+			EV_SET(&kev, child.outfd, EVFILT_READ, EV_ADD, 0, 0,
+			       (void *)(intptr_t)child.pid);
+			if (kevent(evfd, &kev, 1, NULL, 0, NULL) == -1)
+				logging::LogPerror("kevent()");
+			EV_SET(&kev, child.errfd, EVFILT_READ, EV_ADD, 0, 0,
+			       (void *)(intptr_t)child.pid);
+			if (kevent(evfd, &kev, 1, NULL, 0, NULL) == -1)
+				logging::LogPerror("kevent()");
+		}
+		EV_SET(&kev, child.pid, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0,
+		       request.timeout, (void *)(intptr_t)child.pid);
+		if (kevent(evfd, &kev, 1, NULL, 0, NULL) == -1)
+			logging::LogPerror("kevent()");
+		EV_SET(&kev, child.pid, EVFILT_PROC, EV_ADD | EV_ONESHOT,
+		       NOTE_EXIT, 0, (void *)(intptr_t)child.pid);
+		children[child.pid] = std::move(child);
+		/* The zygote reports the exits of its children instead. */
+		if (!zygote::Running() &&
+		    kevent(evfd, &kev, 1, NULL, 0, NULL) == -1) {
+			/* The child has already exited (ESRCH). */
+			Reap(kev.ident, 0, callback);
+		}
+#else
+		children[child.pid] = std::move(child);
+#endif
+	}
+}
+
+/* Reads all the output which the child has produced so far. */
+void
+executor::Executor::Drain(Child& child)
+{
+	Drain(child.outfd, child.output.out, child.output.outsize,
+	      child.output.outdigest);
+	Drain(child.errfd, child.output.err, child.output.errsize,
+	      child.output.errdigest);
+}
+
+/*
+ * Reads all the data available on the descriptor "fd", closing the
+ * descriptor (and setting it to -1) on end-of-file. At most
+ * utils::max_output bytes are retained in "output", while the data
+ * beyond is only accounted for in "size" and "digest".
+ */
+void
+executor::Executor::Drain(int& fd,
+			  std::string& output,
+			  size_t& size,
+			  uint64_t& digest)
+{
+	ssize_t nread;
+
+	if (fd == -1)
+		return;
+
+	while ((nread = read(fd, buffer.data(), buffer.size())) > 0) {
+		size += nread;
+		digest = utils::Hash(buffer.data(), nread, digest);
+		if (output.size() < utils::max_output)
+			output.append(buffer.data(), std::min((size_t)nread,
+				      utils::max_output - output.size()));
+	}
+
+	if (nread == 0 || errno != EAGAIN) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+/*
+ * Collects the output written to the memory file "fd" (which is closed
+ * and set to -1) by an exited child, i.e. the data up to its offset (see
+ * OpenChannel() in utils.cpp), which is at most utils::memfd_limit bytes.
+ * The file is mapped rather than read, hence the data beyond the first
+ * utils::max_output bytes, which is only accounted for in "size" and
+ * "digest", is never copied.
+ */
+void
+executor::Executor::Collect(int& fd,
+			    std::string& output,
+			    size_t& size,
+			    uint64_t& digest)
+{
+	off_t written;
+	void *data;
+
+	if (fd == -1)
+		return;
+
+	if ((written = lseek(fd, 0, SEEK_CUR)) == -1) {
+		logging::LogPerror("lseek()");
+	} else if (written > 0) {
+		written = std::min(written, (off_t)utils::memfd_limit);
+		data = mmap(NULL, written, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED) {
+			logging::LogPerror("mmap()");
+		} else {
+			size = written;
+			digest = utils::Hash((const char *)data, size, digest);
+			output.assign((const char *)data,
+				      std::min(size, utils::max_output));
+			munmap(data, written);
+		}
+	}
+
+	close(fd);
+	fd = -1;
+}
+
+/*
+ * Handles a child hitting its deadline, i.e. terminates it if it has
+ * exhausted its budget, or kills it if it has also outlived the grace
+ * period after being terminated.
+ */
+void
+executor::Executor::Expire(Child& child)
+{
+	if (!child.terminated) {
+		Terminate(child);
+	} else if (!child.killed) {
+		child.killed = true;
+		if (kill(-child.pid, SIGKILL) < 0)
+			logging::LogPerror("kill()");
+	}
+}
+
+/*
+ * Terminates a child which has exhausted its budget. If at this point
+ * the child is still alive, it (most probably) is stuck on a blocking
+ * read waiting for the user input. Since a few of the utilities
+ * performing such blocking reads don't respond to SIGINT (e.g. pax(1)),
+ * we terminate the child via SIGTERM. The signal is sent to the child's
+ * process group so that any processes created by the child are
+ * terminated too. If the child ignores SIGTERM, it is killed once the
+ * grace period runs out (see Expire()).
+ */
+void
+executor::Executor::Terminate(Child& child)
+{
+#ifdef __FreeBSD__
+	struct kevent kev;
+#endif
+
+	if (child.terminated)
+		return;
+
+	child.terminated = true;
+	child.deadline = std::chrono::steady_clock::now()
+		       + std::chrono::milliseconds(utils::grace);
+#ifdef __FreeBSD__
+	EV_SET(&kev, child.pid, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0,
+	       utils::grace, (void *)(intptr_t)child.pid);
+	if (kevent(evfd, &kev, 1, NULL, 0, NULL) == -1)
+		logging::LogPerror("kevent()");
+#endif
+	if (kill(-child.pid, SIGTERM) < 0)
+		logging::LogPerror("kill()");
+	if (child.outfd != -1) {
+		close(child.outfd);
+		child.outfd = -1;
+	}
+	if (child.errfd != -1) {
+		close(child.errfd);
+		child.errfd = -1;
+	}
+}
+
+/*
+ * Reaps the child "pid" if it has exited, collecting its remaining
+ * output, and reports its completion. Returns false if "options"
+ * contains WNOHANG and the child is yet to exit.
+ * The processes left behind by the child are killed before reaping it,
+ * i.e. while its pid (the id of their process group) can't be reused.
+ */
+bool
+executor::Executor::Reap(pid_t pid, int options, Callback& callback)
+{
+	struct rusage ru;
+	siginfo_t si;
+	int pstat;
+	pid_t wpid;
+	int error;
+
+	if (children.find(pid) == children.end())
+		return true;
+
+	/* Wait for the child to exit, leaving it unreaped. */
+	memset(&si, 0, sizeof(si));
+	do {
+		error = waitid(P_PID, pid, &si, WEXITED | WNOWAIT | options);
+	} while (error == -1 && errno == EINTR);
+	if (error == 0 && si.si_pid == 0)
+		return false;
+	if (error == 0)
+		utils::KillStrays(pid);
+
+	/* Retrieve exit status and resource usage of the child. */
+	do {
+		wpid = wait4(pid, &pstat, 0, &ru);
+	} while (wpid == -1 && errno == EINTR);
+
+	Complete(pid, wpid == -1 ? NULL : &pstat, &ru, callback);
+	return true;
+}
+
+/* Completes the children spawned via the zygote which have exited. */
+void
+executor::Executor::ReapZygote(Callback& callback)
+{
+	zygote::Exit done;
+
+	if (!zygote::Running())
+		return;
+
+	while (zygote::NextExit(done))
+		Complete(done.pid, &done.status, &done.ru, callback);
+}
+
+/*
+ * Completes the exited (and reaped) child "pid" with the status "pstat"
+ * (NULL if it couldn't be retrieved) and the resource usage "ru".
+ */
+void
+executor::Executor::Complete(pid_t pid,
+			     const int *pstat,
+			     const struct rusage *ru,
+			     Callback& callback)
+{
+	std::unordered_map<pid_t, Child>::iterator it;
+	Child child;
+#ifdef __FreeBSD__
+	struct kevent kev;
+#endif
+
+	if ((it = children.find(pid)) == children.end())
+		return;
+
+	child = std::move(it->second);
+	children.erase(it);
+
+	Drain(child);
+	if (child.outfd != -1)
+		close(child.outfd);
+	if (child.errfd != -1)
+		close(child.errfd);
+	Collect(child.outmem, child.output.out, child.output.outsize,
+		child.output.outdigest);
+	Collect(child.errmem, child.output.err, child.output.errsize,
+		child.output.errdigest);
+	dirs.Release(child.dir);
+#ifdef __FreeBSD__
+	EV_SET(&kev, pid, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	kevent(evfd, &kev, 1, NULL, 0, NULL);
+#endif
+
+	if (pstat == NULL) {
+		child.output.exitstatus = -1;
+	} else {
+		if (WIFSIGNALED(*pstat))
+			child.output.termsig = WTERMSIG(*pstat);
+		else
+			child.output.exitstatus = WEXITSTATUS(*pstat);
+		child.output.utime = ru->ru_utime.tv_sec * 1000
+				   + ru->ru_utime.tv_usec / 1000;
+		child.output.stime = ru->ru_stime.tv_sec * 1000
+				   + ru->ru_stime.tv_usec / 1000;
+		child.output.maxrss = ru->ru_maxrss;
+		child.output.minflt = ru->ru_minflt;
+		child.output.majflt = ru->ru_majflt;
+	}
+	child.output.timedout = child.terminated;
+	child.output.duration = std::chrono::duration_cast
+		<std::chrono::milliseconds>
+		(std::chrono::steady_clock::now() - child.start).count();
+	DEBUGP("Command: %s, exit status: %d, signal: %d\n",
+	       child.command.c_str(), child.output.exitstatus,
+	       child.output.termsig);
+	callback(child.id, child.output);
+}
+
+/* Waits for, and handles, the next batch of events. */
+void
+executor::Executor::Wait(Callback& callback)
+{
+	std::unordered_map<pid_t, Child>::iterator it;
+#ifdef __FreeBSD__
+	std::array<struct kevent, MAXEVENTS> events;
+	pid_t pid;
+	int nevents;
+	int i;
+
+	if ((nevents = kevent(evfd, NULL, 0, events.data(), MAXEVENTS,
+			      NULL)) == -1) {
+		if (errno != EINTR)
+			logging::LogPerror("kevent()");
+		return;
+	}
+
+	for (i = 0; i < nevents; i++) {
+		pid = (pid_t)(intptr_t)events[i].udata;
+		if (pid == 0) {
+			ReapZygote(callback);
+			continue;
+		}
+		if ((it = children.find(pid)) == children.end())
+			continue;
+
+		switch (events[i].filter) {
+		case EVFILT_READ:
+			Drain(it->second);
+			break;
+		case EVFILT_TIMER:
+			Expire(it->second);
+			break;
+		case EVFILT_PROC:
+			Reap(pid, 0, callback);
+			break;
+		}
+	}
+#else
+	std::vector<struct pollfd> pollfds;
+	std::vector<pid_t> pids;
+	std::chrono::steady_clock::time_point now;
+	long long remaining;
+	int timeout = -1;
+	char byte;
+	size_t first;  /* Index of the first output pipe in "pollfds". */
+	size_t i;
+
+	/*
+	 * Wait for output or an exit of any of the children, but no longer
+	 * than the earliest deadline.
+	 */
+	pollfds.push_back({ evfd, POLLIN, 0 });
+	if (zygote::Running())
+		pollfds.push_back({ zygote::Channel(), POLLIN, 0 });
+	first = pollfds.size();
+	now = std::chrono::steady_clock::now();
+	for (const auto &it : children) {
+		if (it.second.outfd != -1) {
+			pollfds.push_back({ it.second.outfd, POLLIN, 0 });
+			pids.push_back(it.first);
+		}
+		if (it.second.errfd != -1) {
+			pollfds.push_back({ it.second.errfd, POLLIN, 0 });
+			pids.push_back(it.first);
+		}
+		if (it.second.killed)
+			continue;
+		remaining = std::chrono::duration_cast<std::chrono::milliseconds>
+			(it.second.deadline - now).count();
+		if (remaining < 0)
+			remaining = 0;
+		if (timeout == -1 || remaining < timeout)
+			timeout = remaining;
+	}
+
+	if (poll(pollfds.data(), pollfds.size(), timeout) == -1) {
+		if (errno != EINTR)
+			logging::LogPerror("poll()");
+		return;
+	}
+
+	for (i = first; i < pollfds.size(); i++) {
+		if (pollfds[i].revents)
+			Drain(children[pids[i - first]]);
+	}
+
+	now = std::chrono::steady_clock::now();
+	for (auto &it : children) {
+		if (now >= it.second.deadline)
+			Expire(it.second);
+	}
+
+	/* Reap the children which have exited. */
+	if (first > 1 && pollfds[1].revents)
+		ReapZygote(callback);
+	if (pollfds[0].revents) {
+		while (read(evfd, &byte, 1) > 0)
+			;
+	}
+	if (pollfds[0].revents && !zygote::Running()) {
+		pids.clear();
+		for (const auto &it : children)
+			pids.push_back(it.first);
+		for (const auto &pid : pids)
+			Reap(pid, WNOHANG, callback);
+	}
+#endif
+}
@@ -0,0 +1,110 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "scratch.h"
+#include "utils.h"
+
+namespace executor {
+	/* Invoked with the identifier and the result of a completed command. */
+	typedef std::function<void(size_t, utils::ProbeResult&)> Callback;
+
+	/*
+	 * An event loop which executes the submitted commands, keeping at
+	 * most "max_children" of them running at a time. A single thread
+	 * multiplexes the output pipes, exits and deadlines of all the
+	 * children; via kqueue(2) on FreeBSD and poll(2) elsewhere.
+	 */
+	class Executor {
+	public:
+		explicit Executor(size_t);
+		~Executor();
+
+		void Submit(size_t, const std::vector<std::string>&, long);
+		void Run(Callback);
+
+	private:
+		/* A command waiting to be executed. */
+		struct Request {
+			size_t id;
+			std::vector<std::string> command;
+			long timeout;  /* Wall-clock budget (milliseconds). */
+		};
+
+		/* State of a command under execution. */
+		struct Child {
+			size_t id;
+			std::string command;  /* Printable command (for debugging). */
+			int outfd;     /* Read end of the child's stdout (or -1). */
+			int errfd;     /* Read end of the child's stderr (or -1). */
+			/* Memory files of the child's stdout and stderr (or -1). */
+			int outmem;
+			int errmem;
+			pid_t pid;
+			std::string dir;  /* Scratch directory of the child. */
+			bool terminated;  /* Whether the deadline was hit. */
+			bool killed;      /* Whether the grace period ran out. */
+			std::chrono::steady_clock::time_point start;
+			/* Deadline, or the end of the grace period if terminated. */
+			std::chrono::steady_clock::time_point deadline;
+			utils::ProbeResult output;
+		};
+
+		size_t max_children;
+		std::deque<Request> queue;
+		std::unordered_map<pid_t, Child> children;
+		int evfd;  /* kqueue(2) descriptor, or read end of the SIGCHLD pipe. */
+		std::vector<char> buffer;  /* Reused for reading the outputs. */
+		scratch::Pool& dirs;  /* Scratch directories of the children. */
+
+		void StartPending(Callback&);
+		void Drain(Child&);
+		void Drain(int&, std::string&, size_t&, uint64_t&);
+		void Collect(int&, std::string&, size_t&, uint64_t&);
+		void Terminate(Child&);
+		void Expire(Child&);
+		bool Reap(pid_t, int, Callback&);
+		void ReapZygote(Callback&);
+		void Complete(pid_t, const int *, const struct rusage *, Callback&);
+		void Wait(Callback&);
+	};
+}
+
+#endif  /* _EXECUTOR_H_ */
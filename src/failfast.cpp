@@ -0,0 +1,117 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "failfast.h"
+#include "prescreen.h"
+#include "utils.h"
+
+/* These must match the definitions in failfast_shim.c. */
+#define FAILFAST_ENV "SMOKETEST_FAILFAST"
+#define MARKER "smoketest-failfast: "
+/* Exit status of a utility terminated by the shim. */
+#define FAILFAST_STATUS 125
+
+/* Whether the shim is preloaded into the utilities. */
+static bool enabled = false;
+
+/*
+ * Preloads the fail-fast shim "library" (see failfast_shim.c) into
+ * every utility executed hereafter, so that a utility trying to
+ * interact with a terminal is terminated right away instead of being
+ * left blocked until its deadline. Setuid and setgid utilities are
+ * exempt from preloading (see Classify()).
+ */
+void
+failfast::Enable(std::string library)
+{
+	utils::environment.push_back("LD_PRELOAD=" + library);
+	utils::environment.push_back(std::string(FAILFAST_ENV) + "="
+				     + std::to_string(FAILFAST_STATUS));
+	enabled = true;
+}
+
+/*
+ * Whether the binary of "utility" is setuid or setgid, in which case
+ * the dynamic linker ignores LD_PRELOAD, i.e. the shim isn't loaded.
+ */
+static bool
+Privileged(std::string utility)
+{
+	struct stat sb;
+
+	return stat(utils::LookupUtility(utility).c_str(), &sb) == 0 &&
+	       (sb.st_mode & (S_ISUID | S_ISGID));
+}
+
+/*
+ * Marks "output" of a command of "utility" as interactive if the command
+ * was terminated by the shim. Returns whether it was.
+ * The shim can't be preloaded into setuid and setgid utilities (e.g.
+ * passwd(1) or su(1)), whose commands are instead marked as interactive
+ * if they ran out of their budget and the utility was found to be
+ * interactive by prescreen::Scan().
+ */
+bool
+failfast::Classify(std::string utility, utils::ProbeResult& output)
+{
+	size_t pos;
+
+	if (!enabled)
+		return false;
+
+	if (output.timedout) {
+		if (!prescreen::Interactive(utility) || !Privileged(utility))
+			return false;
+		output.interactive = true;
+		return true;
+	}
+
+	if (output.termsig || output.exitstatus != FAILFAST_STATUS)
+		return false;
+
+	/*
+	 * The shim reports the attempt as the last line of stderr, which
+	 * it starts on a line of its own (e.g. after a prompt).
+	 */
+	if (output.err.empty() || output.err.back() != '\n' ||
+	    (pos = output.err.rfind('\n', output.err.size() - 2)) ==
+	    std::string::npos)
+		pos = 0;
+	else
+		pos++;
+	if (output.err.compare(pos, sizeof(MARKER) - 1, MARKER))
+		return false;
+
+	output.interactive = true;
+	return true;
+}
@@ -0,0 +1,212 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * A library preloaded (see ld.so(1)) into the utilities being probed,
+ * which terminates a utility as soon as it tries to interact with a
+ * terminal, instead of letting it block until its deadline. The
+ * attempt is reported on stderr as a line starting with MARKER (preceded
+ * by a newline, in case a prompt was left unterminated), and the utility
+ * exits with the status set in FAILFAST_ENV. The library is inert if
+ * FAILFAST_ENV isn't set.
+ * Note that the dynamic linker ignores LD_PRELOAD for setuid and setgid
+ * binaries, e.g. passwd(1), su(1) or login(1), hence these are never
+ * terminated by the library.
+ * Operations which don't involve a terminal (e.g. isatty(3) on a pipe)
+ * are passed through unchanged. Reads aren't intercepted at all, since
+ * the standard input of the probes is always /dev/null, i.e. a utility
+ * can only reach a terminal by opening it.
+ */
+
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define FAILFAST_ENV "SMOKETEST_FAILFAST"
+#define MARKER "smoketest-failfast: "
+
+/*
+ * Reports the interactive operation "call" on "what", and terminates
+ * the process, unless fail-fast is disabled.
+ */
+static void
+FailFast(const char *call, const char *what)
+{
+	const char *status;
+	char msg[256];
+	int len;
+
+	if ((status = getenv(FAILFAST_ENV)) == NULL)
+		return;
+
+	len = snprintf(msg, sizeof(msg), "\n" MARKER "%s(%s)\n", call, what);
+	if (len > 0)
+		write(STDERR_FILENO, msg, (size_t)len < sizeof(msg) ?
+		      (size_t)len : sizeof(msg) - 1);
+	_exit(atoi(status));
+}
+
+/* Whether "path" refers to the controlling terminal. */
+static int
+IsTty(const char *path)
+{
+	return path != NULL && strcmp(path, "/dev/tty") == 0;
+}
+
+/* Resolves the next (i.e. the real) definition of "symbol". */
+static void *
+Next(const char *symbol)
+{
+	void *sym;
+
+	if ((sym = dlsym(RTLD_NEXT, symbol)) == NULL)
+		abort();
+
+	return sym;
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	static int (*real_open)(const char *, int, ...);
+	va_list ap;
+	int mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (IsTty(path))
+		FailFast("open", path);
+	if (real_open == NULL)
+		real_open = Next("open");
+
+	return real_open(path, flags, mode);
+}
+
+#ifdef __GLIBC__
+/* Called instead of open() by the programs using large file support. */
+int
+open64(const char *path, int flags, ...)
+{
+	static int (*real_open64)(const char *, int, ...);
+	va_list ap;
+	int mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (IsTty(path))
+		FailFast("open64", path);
+	if (real_open64 == NULL)
+		real_open64 = Next("open64");
+
+	return real_open64(path, flags, mode);
+}
+#endif
+
+int
+openat(int fd, const char *path, int flags, ...)
+{
+	static int (*real_openat)(int, const char *, int, ...);
+	va_list ap;
+	int mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (IsTty(path))
+		FailFast("openat", path);
+	if (real_openat == NULL)
+		real_openat = Next("openat");
+
+	return real_openat(fd, path, flags, mode);
+}
+
+int
+tcgetattr(int fd, struct termios *t)
+{
+	static int (*real_tcgetattr)(int, struct termios *);
+	int ret;
+
+	if (real_tcgetattr == NULL)
+		real_tcgetattr = Next("tcgetattr");
+	if ((ret = real_tcgetattr(fd, t)) == 0)
+		FailFast("tcgetattr", "terminal");
+
+	return ret;
+}
+
+int
+tcsetattr(int fd, int action, const struct termios *t)
+{
+	static int (*real_tcsetattr)(int, int, const struct termios *);
+
+	/* Leave the terminal's settings untouched. */
+	if (isatty(fd))
+		FailFast("tcsetattr", "terminal");
+	if (real_tcsetattr == NULL)
+		real_tcsetattr = Next("tcsetattr");
+
+	return real_tcsetattr(fd, action, t);
+}
+
+char *
+readpassphrase(const char *prompt, char *buf, size_t bufsiz, int flags)
+{
+	static char *(*real_readpassphrase)(const char *, char *, size_t, int);
+
+	FailFast("readpassphrase", "terminal");
+	if (real_readpassphrase == NULL)
+		real_readpassphrase = Next("readpassphrase");
+
+	return real_readpassphrase(prompt, buf, bufsiz, flags);
+}
+
+char *
+getpass(const char *prompt)
+{
+	static char *(*real_getpass)(const char *);
+
+	FailFast("getpass", "terminal");
+	if (real_getpass == NULL)
+		real_getpass = Next("getpass");
+
+	return real_getpass(prompt);
+}
@@ -27,27 +27,19 @@
  */
 
 #include <cstdlib>
-#include <cstring>
 #include <iostream>
 
 #include "generate_license.h"
 #include "utils.h"
 
 std::string
-generatelicense::GenerateLicense(int argc, char **argv)
+generatelicense::GenerateLicense(std::string copyright_owner)
 {
 	std::string license;
-	std::string copyright_owner;
 
-	if (argc > 1) {
-		if (argc == 3 && strncmp(argv[1], "--name ", 7))
-			copyright_owner = argv[2];
-		else {
-			std::cerr << "Usage: ./generate_tests --name <copyright_owner>\n";
-			exit(EXIT_FAILURE);
-		}
-	} else
-		copyright_owner = utils::Execute("id -P | cut -d : -f 8").first;
+	/* Fall back to the full name of the current user. */
+	if (copyright_owner.empty())
+		copyright_owner = utils::Execute("id -P | cut -d : -f 8").out;
 
 	license =
 		"#\n"
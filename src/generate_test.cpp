@@ -27,9 +27,13 @@
  */
 
 #include <dirent.h>
+#include <getopt.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <fstream>
@@ -38,11 +42,29 @@
 #include <unordered_set>
 
 #include "add_testcase.h"
+#include "coprocess.h"
+#include "failfast.h"
 #include "fetch_groff.h"
 #include "generate_license.h"
 #include "generate_test.h"
 #include "logging.h"
+#include "option_index.h"
+#include "probe_cache.h"
+#include "prescreen.h"
+#include "probe_report.h"
 #include "read_annotations.h"
+#include "timing.h"
+#include "transcript.h"
+#include "zygote.h"
+
+/*
+ * Whether the per-utility progress is to be reported by GenerateTest().
+ * Workers generating tests in parallel leave this to the parent process.
+ */
+static bool show_progress = true;
+
+/* Maximum number of commands executed concurrently for a utility. */
+static size_t max_probes = 8;
 
 void
 generatetest::IntHandler(int dummmy)
@@ -74,14 +96,16 @@ generatetest::GenerateTest(std::string utility,
 			   const char *testsdir)
 {
 	std::vector<std::string> usage_messages;
+	std::vector<std::vector<std::string>> commands;
+	std::vector<utils::ProbeResult> outputs;
 	std::vector<utils::OptRelation *> identified_opts;
-	std::string command;
+	std::vector<std::string> command;
 	std::string testcase_list;
 	std::string buffer;
 	std::string testfile;
 	std::string util_with_section;
 	std::ofstream file;
-	std::pair<std::string, int> output;
+	utils::ProbeResult output;
 	std::unordered_set<std::string> annotation_set;
 	/* Number of options for which a testcase has been generated. */
 	int progress = 0;
@@ -92,11 +116,17 @@ generatetest::GenerateTest(std::string utility,
 	util_with_section = utility + '(' + section + ')';
 	utils::OptDefinition opt_def;
 	identified_opts = opt_def.CheckOpts(utility);
+	/* Ignore the identified options which are annotated. */
+	identified_opts.erase(std::remove_if(identified_opts.begin(),
+		identified_opts.end(), [&](const utils::OptRelation *i) {
+			return annotation_set.find(i->value) !=
+			       annotation_set.end();
+		}), identified_opts.end());
 	testfile = testsdir + utility + "_test.sh";
 
 #ifndef DEBUG
 	/* Indicate the start of test generation for current utility. */
-	if (isatty(fileno(stderr))) {
+	if (show_progress && isatty(fileno(stderr))) {
 		std::cerr << std::setw(18) << util_with_section << " | "
 			  << progress << "/" << opt_def.opt_list.size() << "\r";
 	}
@@ -105,6 +135,22 @@ generatetest::GenerateTest(std::string utility,
 	file.open(testfile, std::ios::out);
 	file << license;
 
+	/*
+	 * Execute all the commands required for generating the test at
+	 * once. Since the results are memoized, each of these commands is
+	 * executed only once even when it is needed at multiple places,
+	 * e.g. while selecting the usage message and while generating the
+	 * testcase for an option.
+	 */
+	for (const auto &i : identified_opts)
+		commands.push_back(utils::GenerateCommand(utility, i->value));
+	for (const auto &i : opt_def.opt_list)
+		commands.push_back(utils::GenerateCommand(utility, i));
+	if (annotation_set.find("*") == annotation_set.end())
+		commands.push_back(utils::GenerateCommand(utility, ""));
+	utils::ExecuteBatch(commands, max_probes);
+	commands.clear();
+
 	/*
 	 * If a known option was encountered (i.e. `identified_opts` is
 	 * populated), produce a testcase to check the validity of the
@@ -112,33 +158,44 @@ generatetest::GenerateTest(std::string utility,
 	 * produce testcases to verify the correct (generated) usage
 	 * message when using the supported options incorrectly.
 	 */
-	for (const auto &i : identified_opts) {
-		command = utils::GenerateCommand(utility, i->value);
-		output = utils::Execute(command);
-		if (boost::iequals(output.first.substr(0, 6), "usage:")) {
+	for (const auto &i : identified_opts)
+		commands.push_back(utils::GenerateCommand(utility, i->value));
+	outputs = utils::ExecuteBatch(commands, max_probes);
+
+	for (size_t j = 0; j < identified_opts.size(); j++) {
+		const auto &i = identified_opts[j];
+		output = outputs[j];
+		/*
+		 * A probe which timed out or needed a terminal cannot be
+		 * verified by atf_check(1).
+		 */
+		if (output.timedout || output.interactive)
+			continue;
+		if (boost::iequals(output.err.substr(0, 6), "usage:") ||
+		    boost::iequals(output.out.substr(0, 6), "usage:")) {
 			/* Our guessed usage is incorrect as usage message is produced. */
 			addtestcase::UnknownTestcase(i->value, util_with_section,
 						     output, buffer, usage_output);
 		} else {
 			addtestcase::KnownTestcase(i->value, util_with_section,
-						   "", output.first, file);
+						   "", output, file);
 		}
-		testcase_list.append("\tatf_add_test_case " + i->value + "_flag\n");
+		testcase_list.append("\tatf_add_test_case "
+				     + addtestcase::TestcaseName(i->value) + "\n");
 	}
 
 	/* Add testcases for the options whose usage is not yet known.
 	 * For the purpose of adding a "$usage_output" variable,
 	 * we choose the option which produces one.
-	 * TODO Avoid double executions of an option, i.e. one while
-	 * selecting usage message and another while generating testcase.
 	 */
 	if (opt_def.opt_list.size() == 1) {
 		/* Check if the single option produces a usage message. */
 		command = utils::GenerateCommand(utility, opt_def.opt_list.front());
 		output = utils::Execute(command);
-		if (output.second && !output.first.empty()) {
+		if (!output.Succeeded() && !output.interactive &&
+		    !output.err.empty()) {
 			usage_output = true;
-			file << "usage_output=\'" + output.first + "\'\n\n";
+			file << "usage_output=\'" + output.err + "\'\n\n";
 		}
 	} else if (opt_def.opt_list.size() > 1) {
 		/*
@@ -146,19 +203,23 @@ generatetest::GenerateTest(std::string utility,
 		 * is consistent for atleast "two" options, we reduce duplication
 		 * by assigning a variable "usage_output" in the test script.
 		 */
-		for (const auto &i : opt_def.opt_list) {
-			command = utils::GenerateCommand(utility, i);
-			output = utils::Execute(command);
-			if (output.second && usage_messages.size() < 3)
-				usage_messages.push_back(output.first);
+		commands.clear();
+		for (const auto &i : opt_def.opt_list)
+			commands.push_back(utils::GenerateCommand(utility, i));
+		outputs = utils::ExecuteBatch(commands, max_probes);
+
+		for (const auto &i : outputs) {
+			if (!i.Succeeded() && !i.timedout && !i.interactive &&
+			    usage_messages.size() < 3)
+				usage_messages.push_back(i.err);
 		}
 
-		for (int j = 0; j < usage_messages.size(); j++) {
+		for (size_t j = 0; j < usage_messages.size(); j++) {
 			if (!usage_messages[j].compare
 					(usage_messages[(j+1) % usage_messages.size()])) {
 				usage_output = true;
 				file << "usage_output=\'"
-					      + output.first.substr(0, 7 + utility.size())
+					      + usage_messages[j].substr(0, 7 + utility.size())
 					      + "\'\n\n";
 				break;
 			}
@@ -166,35 +227,44 @@ generatetest::GenerateTest(std::string utility,
 	}
 
 	/*
-	 * Execute the utility with supported options, while
-	 * adding positive and negative testcases accordingly.
+	 * Execute the utility with supported options (all of them at
+	 * once), while adding positive and negative testcases accordingly.
 	 */
+	commands.clear();
 	for (const auto &i : opt_def.opt_list) {
 		/* Ignore the option if it is annotated. */
+		if (annotation_set.find(i) == annotation_set.end())
+			commands.push_back(utils::GenerateCommand(utility, i));
+	}
+	outputs = utils::ExecuteBatch(commands, max_probes);
+
+	for (const auto &i : opt_def.opt_list) {
 		if (annotation_set.find(i) != annotation_set.end())
 			continue;
 
-		command = utils::GenerateCommand(utility, i);
-		output = utils::Execute(command);
+		output = outputs[progress++];
 #ifndef DEBUG
-		if (isatty(fileno(stderr))) {
+		if (show_progress && isatty(fileno(stderr))) {
 			std::cerr << std::setw(18) << util_with_section
-				  << " | " << ++progress << "/"
+				  << " | " << progress << "/"
 				  << opt_def.opt_list.size() << "\r";
 		}
 #endif
-		if (output.second) {
+		if (output.timedout || output.interactive)
+			continue;
+		if (!output.Succeeded()) {
 			addtestcase::UnknownTestcase(i, util_with_section, output,
 						     buffer, usage_output);
 		} else {
 			/* Guessed usage is correct as EXIT_SUCCESS is encountered */
 			addtestcase::KnownTestcase(i, util_with_section, "",
-						   output.first, file);
+						   output, file);
 			testcase_list.append(std::string("\tatf_add_test_case ")
-					     + i + "_flag\n");
+					     + addtestcase::TestcaseName(i) + "\n");
 		}
 	}
-	std::cout << std::endl;  /* Takes care of the last '\r'. */
+	if (show_progress)
+		std::cout << std::endl;  /* Takes care of the last '\r'. */
 
 	if (!opt_def.opt_list.empty()) {
 		testcase_list.append("\tatf_add_test_case invalid_usage\n");
@@ -213,13 +283,141 @@ generatetest::GenerateTest(std::string utility,
 	if (annotation_set.find("*") == annotation_set.end()) {
 		command = utils::GenerateCommand(utility, "");
 		output = utils::Execute(command);
-		addtestcase::NoArgsTestcase(util_with_section, output,
-					    file, usage_output);
-		testcase_list.append("\tatf_add_test_case no_arguments\n");
+		if (!output.timedout && !output.interactive) {
+			addtestcase::NoArgsTestcase(util_with_section, output,
+						    file, usage_output);
+			testcase_list.append("\tatf_add_test_case no_arguments\n");
+		}
 	}
 
 	file << "atf_init_test_cases()\n{\n" + testcase_list + "}\n";
 	file.close();
+	utils::ClearProbeCache();
+}
+
+/*
+ * [Parallel mode] Generate tests for all the utilities in "groff_map"
+ * using at most "jobs" worker processes. Each worker is forked for a
+ * single utility and executes its commands inside a scratch directory
+ * of its own, which is recycled once the worker exits.
+ */
+int
+generatetest::GenerateTestsParallel(std::string& license,
+				    const char *testsdir,
+				    int jobs)
+{
+	std::unordered_map<pid_t, std::pair<int, std::string>> workers;
+	std::unordered_map<pid_t, std::pair<int, std::string>>::iterator worker;
+	std::vector<int> free_slots;
+	std::string slotdir;
+	int slot;
+	int wstatus;
+	int retval = EXIT_SUCCESS;
+	size_t done = 0;  /* Number of utilities processed so far. */
+	pid_t pid;
+
+	for (slot = jobs - 1; slot >= 0; slot--)
+		free_slots.push_back(slot);
+
+	for (const auto &it : groff::groff_map) {
+		/* Wait for a worker to finish if all the slots are occupied. */
+		while (free_slots.empty()) {
+			if ((pid = wait(&wstatus)) == -1) {
+				if (errno == EINTR)
+					continue;
+				perror("wait");
+				return EXIT_FAILURE;
+			}
+			if ((worker = workers.find(pid)) == workers.end())
+				continue;
+			ReapWorker(worker->second, wstatus, ++done);
+			free_slots.push_back(worker->second.first);
+			workers.erase(worker);
+		}
+
+		slot = free_slots.back();
+		free_slots.pop_back();
+
+		/* Start with a clean scratch directory for every utility. */
+		slotdir = std::string(utils::tmpdir) + "/" + std::to_string(slot);
+		boost::filesystem::remove_all(slotdir);
+		boost::filesystem::create_directory(slotdir);
+
+		/* Avoid duplicating the buffered output in the worker. */
+		std::cout.flush();
+		std::cerr.flush();
+
+		switch (pid = fork()) {
+		case -1:
+			perror("fork");
+			retval = EXIT_FAILURE;
+			break;
+		case 0:
+			/* The parent takes care of cleanup on interrupts. */
+			signal(SIGINT, SIG_DFL);
+			utils::AcquireReaper();
+			show_progress = false;
+			utils::workdir = slotdir;
+			generatetest::GenerateTest(it.first, it.second.back(),
+						   license, testsdir);
+			std::cout.flush();
+			_exit(EXIT_SUCCESS);
+		default:
+			workers[pid] = std::make_pair(slot, it.first + '('
+						      + it.second.back() + ')');
+			continue;
+		}
+		break;
+	}
+
+	/* Wait for the remaining workers. */
+	while (!workers.empty()) {
+		if ((pid = wait(&wstatus)) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("wait");
+			return EXIT_FAILURE;
+		}
+		if ((worker = workers.find(pid)) == workers.end())
+			continue;
+		ReapWorker(worker->second, wstatus, ++done);
+		workers.erase(worker);
+	}
+
+	return retval;
+}
+
+/* [Parallel mode] Report the completion of a worker. */
+void
+generatetest::ReapWorker(std::pair<int, std::string>& worker,
+			 int wstatus,
+			 size_t done)
+{
+	if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+		std::cerr << "Unable to generate test for " << worker.second << "\n";
+#ifndef DEBUG
+	std::cout << std::setw(18) << worker.second << " | " << done
+		  << "/" << groff::groff_map.size() << std::endl;
+#endif
+}
+
+/* Prints the usage of the tool and exits. */
+void
+generatetest::Usage()
+{
+	std::cerr << "Usage: ./generate_tests [--jobs <n>] [--probes <n>] "
+		     "[--timeout <ms>] [--no-cache]\n"
+		     "                      [--max-output <bytes>] "
+		     "[--name <copyright_owner>]\n"
+		     "                      [--report <file>] "
+		     "[--fixture <dir>] [--zygote]\n"
+		     "                      [--coprocess] [--grace <ms>] "
+		     "[--fixed-timeout]\n"
+		     "                      [--failfast <library>] "
+		     "[--no-prescreen] [--memfd]\n"
+		     "                      [--record <file> | "
+		     "--replay <file>]\n";
+	exit(EXIT_FAILURE);
 }
 
 int
@@ -240,6 +438,141 @@ main(int argc, char **argv)
 	 */
 	bool batch_mode = false;
 	int batch_limit;  /* Number of tests to be generated in batch mode. */
+	/*
+	 * Number of utilities for which tests are generated in parallel.
+	 * A value of 0 corresponds to the number of online processors.
+	 */
+	int jobs = 1;
+	/*
+	 * Whether the utilities are spawned by a helper process forked
+	 * at startup, instead of by the (larger) generator itself.
+	 */
+	bool use_zygote = false;
+	long probes;
+	long long max_output;
+	int ch;
+	char *end;
+	std::string copyright_owner;
+	/* Transcripts to be recorded to and replayed from, respectively. */
+	std::string record;
+	std::string replay;
+	std::vector<std::string> utilities;
+	/* Utilities whose "--help" is probed ahead of generation. */
+	std::vector<std::string> help_probed;
+	int nutils = 0;
+	std::unordered_set<std::string> annotation_set;
+	const struct option longopts[] = {
+		{ "coprocess",	no_argument,		NULL,	'c' },
+		{ "failfast",	required_argument,	NULL,	'F' },
+		{ "fixed-timeout", no_argument,		NULL,	'T' },
+		{ "fixture",	required_argument,	NULL,	'f' },
+		{ "grace",	required_argument,	NULL,	'g' },
+		{ "jobs",	required_argument,	NULL,	'j' },
+		{ "max-output",	required_argument,	NULL,	'm' },
+		{ "memfd",	no_argument,		NULL,	'M' },
+		{ "name",	required_argument,	NULL,	'n' },
+		{ "no-cache",	no_argument,		NULL,	'C' },
+		{ "no-prescreen", no_argument,		NULL,	'P' },
+		{ "probes",	required_argument,	NULL,	'p' },
+		{ "record",	required_argument,	NULL,	'R' },
+		{ "replay",	required_argument,	NULL,	'Y' },
+		{ "report",	required_argument,	NULL,	'r' },
+		{ "timeout",	required_argument,	NULL,	't' },
+		{ "zygote",	no_argument,		NULL,	'z' },
+		{ NULL,		0,			NULL,	0 }
+	};
+
+	while ((ch = getopt_long(argc, argv, "CF:MPR:TY:cf:g:j:m:n:p:r:t:z", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'C':
+			probecache::enabled = false;
+			optindex::enabled = false;
+			break;
+		case 'F':
+			if (stat(optarg, &sb) != 0 || !S_ISREG(sb.st_mode))
+				generatetest::Usage();
+			failfast::Enable(boost::filesystem::canonical(optarg)
+					 .string());
+			break;
+		case 'M':
+			utils::memfd_capture = true;
+			break;
+		case 'P':
+			prescreen::enabled = false;
+			break;
+		case 'R':
+			record = optarg;
+			break;
+		case 'T':
+			timing::enabled = false;
+			break;
+		case 'Y':
+			replay = optarg;
+			break;
+		case 'c':
+			coprocess::enabled = true;
+			break;
+		case 'f':
+			if (stat(optarg, &sb) != 0 || !S_ISDIR(sb.st_mode))
+				generatetest::Usage();
+			utils::fixture = boost::filesystem::canonical(optarg)
+					 .string();
+			break;
+		case 'g':
+			utils::grace = strtol(optarg, &end, 10);
+			if (*end != '\0' || utils::grace < 0)
+				generatetest::Usage();
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if (*end != '\0' || jobs < 0)
+				generatetest::Usage();
+			if (jobs == 0 && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+				jobs = 1;
+			break;
+		case 'm':
+			max_output = strtoll(optarg, &end, 10);
+			if (*end != '\0' || max_output <= 0)
+				generatetest::Usage();
+			utils::max_output = max_output;
+			break;
+		case 'n':
+			copyright_owner = optarg;
+			break;
+		case 'p':
+			probes = strtol(optarg, &end, 10);
+			if (*end != '\0' || probes <= 0)
+				generatetest::Usage();
+			max_probes = probes;
+			break;
+		case 'r':
+			probereport::path = optarg;
+			break;
+		case 't':
+			utils::timeout = strtol(optarg, &end, 10);
+			if (*end != '\0' || utils::timeout <= 0)
+				generatetest::Usage();
+			break;
+		case 'z':
+			use_zygote = true;
+			break;
+		default:
+			generatetest::Usage();
+		}
+	}
+	if (optind != argc || (!record.empty() && !replay.empty()))
+		generatetest::Usage();
+	if (!replay.empty() && !transcript::Replay(replay)) {
+		std::cerr << "Unable to replay the transcript: " << replay << "\n";
+		return EXIT_FAILURE;
+	}
+
+	/* Start the zygote while our footprint is still small. */
+	if (use_zygote && !transcript::Replaying() && !zygote::Start())
+		std::cerr << "Failed to start the zygote, "
+			     "spawning the utilities directly\n";
+	/* Processes left behind by the commands are reparented to us. */
+	utils::AcquireReaper();
 
 	/* Handle interrupts. */
 	signal(SIGINT, generatetest::IntHandler);
@@ -247,11 +580,21 @@ main(int argc, char **argv)
 	if (groff::FetchGroffScripts() == EXIT_FAILURE)
 		return EXIT_FAILURE;
 
+	/* Spot the utilities which are likely to wait for user input. */
+	for (const auto &it : groff::groff_map)
+		utilities.push_back(it.first);
+	if (!transcript::Replaying())
+		prescreen::Scan(utilities);
+
 	/*
 	 * Create a temporary directory where all the side-effects
 	 * introduced by utility-specific commands are restricted.
 	 */
 	boost::filesystem::create_directory(utils::tmpdir);
+	probereport::Open();
+	optindex::Open();
+	if (!record.empty() && !transcript::Record(record))
+		return EXIT_FAILURE;
 
 	std::cout << "\nInstead of generating tests for all the utilities, 'batch mode'\n"
 		     "allows generation of tests for first few utilities selected from\n"
@@ -292,7 +635,25 @@ main(int argc, char **argv)
 	}
 
 	/* Generate a license to be added in the generated scripts. */
-	license = generatelicense::GenerateLicense(argc, argv);
+	license = generatelicense::GenerateLicense(copyright_owner);
+
+	/*
+	 * Probe "--help" of all the utilities to be generated for at once,
+	 * for the long options mentioned in their usage messages (see
+	 * utils::CheckOpts()). The utilities annotated not to be executed
+	 * without arguments, or whose testcase for "--help" is annotated,
+	 * are left alone.
+	 */
+	for (const auto &it : groff::groff_map) {
+		if (batch_mode && nutils++ == batch_limit)
+			break;
+		annotation_set.clear();
+		annotations::read_annotations(it.first, annotation_set);
+		if (annotation_set.find("*") == annotation_set.end() &&
+		    annotation_set.find("-help") == annotation_set.end())
+			help_probed.push_back(it.first);
+	}
+	utils::ProbeHelp(help_probed, max_probes * jobs);
 
 #ifndef DEBUG
 	/* Generate a tabular-like format. */
@@ -391,6 +752,12 @@ main(int argc, char **argv)
 				continue;
 			}
 		}
+	} else if (jobs > 1) {
+		if (generatetest::GenerateTestsParallel(license, testsdir, jobs)
+				== EXIT_FAILURE) {
+			boost::filesystem::remove_all(utils::tmpdir);
+			return EXIT_FAILURE;
+		}
 	} else {
 		for (const auto &it : groff::groff_map) {
 			generatetest::GenerateTest(it.first, it.second.back(),
@@ -399,6 +766,9 @@ main(int argc, char **argv)
 	}
 
 	/* Cleanup. */
+	probereport::Close();
+	transcript::Close();
+	optindex::Close();
 	boost::filesystem::remove_all(utils::tmpdir);
 	return EXIT_SUCCESS;
 }
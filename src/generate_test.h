@@ -36,6 +36,9 @@ namespace generatetest {
 	void GenerateMakefile(std::string, std::string);
 	void GenerateTest(std::string, char,
 			  std::string&, const char*);
+	int GenerateTestsParallel(std::string&, const char*, int);
+	void ReapWorker(std::pair<int, std::string>&, int, size_t);
+	void Usage();
 }
 
 #endif  /* _GENERATE_TEST_H_ */
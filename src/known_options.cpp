@@ -0,0 +1,176 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include <array>
+#include <queue>
+#include <vector>
+
+#include "known_options.h"
+#include "known_options_table.h"
+
+/* Number of distinct keywords of all the semantics. */
+static constexpr size_t nkeywords = sizeof(keywords) / sizeof(keywords[0]);
+
+/* Checks, while compiling, that the generated table agrees with Hash(). */
+static constexpr bool
+Consistent(unsigned slot)
+{
+	return slot == KNOWN_SLOTS ||
+	    ((options[slot].name == NULL ||
+	      knownopts::Hash(options[slot].name, KNOWN_SEED, KNOWN_SLOTS)
+			== slot) && Consistent(slot + 1));
+}
+
+static_assert(Consistent(0), "The table of known options is inconsistent");
+
+/*
+ * Aho-Corasick automaton matching all the keywords at once, in a single
+ * pass over a description. Its failure transitions are folded into
+ * "next", i.e. it is a DFA, from the state of which the keywords ending
+ * at the current character are read.
+ */
+struct Automaton {
+	std::vector<std::array<unsigned, 256>> next;
+	/* Keywords (indices in "keywords") recognized in each state. */
+	std::vector<std::vector<unsigned>> matches;
+};
+
+static Automaton
+Build()
+{
+	Automaton automaton;
+	std::vector<unsigned> fail;
+	std::queue<unsigned> queue;
+	const unsigned char *c;
+	unsigned state;
+	unsigned child;
+	size_t i;
+
+	/* The trie of the keywords, rooted at state 0. */
+	automaton.next.emplace_back();
+	automaton.matches.emplace_back();
+	for (i = 0; i < nkeywords; i++) {
+		state = 0;
+		for (c = (const unsigned char *)keywords[i]; *c != '\0'; c++) {
+			if (automaton.next[state][*c] == 0) {
+				automaton.next[state][*c] = automaton.next.size();
+				automaton.next.emplace_back();
+				automaton.matches.emplace_back();
+			}
+			state = automaton.next[state][*c];
+		}
+		automaton.matches[state].push_back(i);
+	}
+
+	/*
+	 * Visit the trie breadth-first, so that the failure state of a
+	 * state (i.e. the state of its longest proper suffix), which is
+	 * shallower, is complete by the time the state is visited.
+	 */
+	fail.assign(automaton.next.size(), 0);
+	for (i = 0; i < 256; i++) {
+		if ((child = automaton.next[0][i]) != 0)
+			queue.push(child);
+	}
+	while (!queue.empty()) {
+		state = queue.front();
+		queue.pop();
+		automaton.matches[state].insert(automaton.matches[state].end(),
+			automaton.matches[fail[state]].begin(),
+			automaton.matches[fail[state]].end());
+		for (i = 0; i < 256; i++) {
+			if ((child = automaton.next[state][i]) != 0) {
+				fail[child] = automaton.next[fail[state]][i];
+				queue.push(child);
+			} else {
+				automaton.next[state][i] =
+					automaton.next[fail[state]][i];
+			}
+		}
+	}
+
+	return automaton;
+}
+
+/*
+ * Whether the "len" bytes of "text" ending at "end" (exclusive) form
+ * whole words, i.e. aren't preceded or followed by an alphanumeric
+ * character, e.g. "version" in "conversion" doesn't.
+ */
+static bool
+WholeWords(boost::string_view text, size_t end, size_t len)
+{
+	return (end == len || !isalnum((unsigned char)text[end - len - 1])) &&
+	       (end == text.size() || !isalnum((unsigned char)text[end]));
+}
+
+/*
+ * Returns the name of the first known semantic of "option" (see
+ * utils::CheckOpts()) which its description (case-insensitively)
+ * mentions any keyword of as whole words, or NULL if the semantics of
+ * the option are unknown.
+ */
+const char *
+knownopts::Identify(const std::string& option, boost::string_view description)
+{
+	static const Automaton automaton = Build();
+	const knownopts::Option& entry =
+		options[Hash(option.c_str(), KNOWN_SEED, KNOWN_SLOTS)];
+	std::array<bool, nkeywords> found = {};
+	unsigned state = 0;
+	unsigned i;
+	unsigned j;
+	size_t pos;
+
+	/* The slot of an unknown option is empty, or has another option. */
+	if (entry.name == NULL || option != entry.name)
+		return NULL;
+
+	for (pos = 0; pos < description.size(); pos++) {
+		state = automaton.next[state]
+			[tolower((unsigned char)description[pos])];
+		for (const auto &k : automaton.matches[state]) {
+			if (WholeWords(description, pos + 1,
+				       strlen(keywords[k])))
+				found[k] = true;
+		}
+	}
+
+	for (i = entry.first; i < entry.first + entry.count; i++) {
+		for (j = semantics[i].first;
+		     j < semantics[i].first + semantics[i].count; j++) {
+			if (found[semantic_keywords[j]])
+				return semantics[i].name;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _KNOWN_OPTIONS_H_
+#define _KNOWN_OPTIONS_H_
+
+#include <boost/utility/string_view.hpp>
+#include <string>
+
+namespace knownopts {
+	/* A known semantic of an option, e.g. "verbose". */
+	struct Semantic {
+		const char *name;
+		/* Keywords revealing it (see semantic_keywords). */
+		unsigned first;
+		unsigned count;
+	};
+
+	/*
+	 * An option with known semantics, in the slot of the table given
+	 * by the hash of its name (see Hash()).
+	 */
+	struct Option {
+		const char *name;  /* Name, or NULL for an empty slot. */
+		/* Its semantics (see semantics). */
+		unsigned first;
+		unsigned count;
+	};
+
+	/*
+	 * Hashes "name" to a slot of a table of "size" slots. For the
+	 * seed chosen when the table is generated (from the file
+	 * "known_options"), the hash is perfect, i.e. every option of
+	 * the table has a slot of its own.
+	 */
+	constexpr unsigned
+	Hash(const char *name, unsigned seed, unsigned size, unsigned h)
+	{
+		return *name == '\0' ? h :
+		    Hash(name + 1, seed, size,
+			 (h * seed + (unsigned char)*name) % size);
+	}
+
+	constexpr unsigned
+	Hash(const char *name, unsigned seed, unsigned size)
+	{
+		return Hash(name, seed, size, seed % size);
+	}
+
+	const char *Identify(const std::string&, boost::string_view);
+}
+
+#endif  /* _KNOWN_OPTIONS_H_ */
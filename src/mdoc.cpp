@@ -0,0 +1,438 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mdoc.h"
+
+/* Macros which can be called from the arguments of another macro. */
+static const std::unordered_set<std::string> callable = {
+	"Ac", "Ao", "Ap", "Aq", "Ar", "Bc", "Bo", "Bq", "Brc", "Bro", "Brq",
+	"Bsx", "Cm", "Dc", "Do", "Dq", "Dv", "Dx", "Ec", "Em", "En", "Eo",
+	"Er", "Ev", "Fa", "Fc", "Fl", "Fo", "Fr", "Ft", "Fx", "Ic", "Li", "Lk",
+	"Ms", "Mt", "Nm", "No", "Ns", "Nx", "Oc", "Oo", "Op", "Ox", "Pa", "Pc",
+	"Pf", "Po", "Pq", "Qc", "Ql", "Qo", "Qq", "Sc", "So", "Sq", "Sx", "Sy",
+	"Tn", "Ux", "Va", "Vt", "Xc", "Xo", "Xr"
+};
+
+/* Arguments which are punctuation rather than content. */
+static const std::unordered_set<std::string> delimiters = {
+	"(", "[", "|", ")", "]", ".", ",", ":", ";", "?", "!"
+};
+
+/* State of the optional groups while scanning SYNOPSIS. */
+struct Groups {
+	int last;  /* Index of the last group opened. */
+	int open;  /* Index of the innermost multi-line group (.Oo), or -1. */
+};
+
+/*
+ * Decodes the escape sequence starting at "line[pos]" into "token".
+ * Returns the length of the sequence. Sequences which don't affect
+ * option names (e.g. special characters) are retained as is, while
+ * font changes and zero-width characters are dropped.
+ */
+static size_t
+Unescape(boost::string_view line, size_t pos, std::string& token)
+{
+	size_t end;
+
+	if (pos + 1 >= line.size()) {
+		token.push_back('\\');
+		return 1;
+	}
+
+	switch (line[pos + 1]) {
+	case '&':
+	case '|':
+	case '^':
+	case '%':
+		return 2;
+	case '-':
+	case '.':
+	case ' ':
+	case '\\':
+		token.push_back(line[pos + 1]);
+		return 2;
+	case 'e':
+		token.push_back('\\');
+		return 2;
+	case 'f':
+		/* Font change, i.e. "\fX", "\f(XX" or "\f[...]". */
+		if (pos + 2 < line.size() && line[pos + 2] == '(')
+			return std::min((size_t)5, line.size() - pos);
+		if (pos + 2 < line.size() && line[pos + 2] == '[' &&
+		    (end = line.find(']', pos + 3)) != boost::string_view::npos)
+			return end - pos + 1;
+		return std::min((size_t)3, line.size() - pos);
+	case '(':
+		end = std::min((size_t)4, line.size() - pos);
+		token.append(line.data() + pos, end);
+		return end;
+	default:
+		token.append(line.data() + pos, 2);
+		return 2;
+	}
+}
+
+/*
+ * Splits "line", i.e. a text line or the part of a macro line following
+ * the control character, into its arguments. Arguments are separated by
+ * blanks unless enclosed in double quotes (within which "" stands for a
+ * quote), escape sequences are decoded (see Unescape()) and comments are
+ * stripped.
+ */
+std::vector<std::string>
+mdoc::Tokenize(boost::string_view line)
+{
+	std::vector<std::string> tokens;
+	std::string token;
+	size_t i = 0;
+	bool quoted;
+	bool comment = false;
+
+	while (i < line.size() && !comment) {
+		while (i < line.size() && (line[i] == ' ' || line[i] == '\t'))
+			i++;
+		if (i == line.size())
+			break;
+
+		token.clear();
+		if ((quoted = line[i] == '"'))
+			i++;
+		while (i < line.size()) {
+			if (quoted && line[i] == '"') {
+				if (i + 1 < line.size() && line[i + 1] == '"') {
+					token.push_back('"');
+					i += 2;
+					continue;
+				}
+				i++;
+				break;
+			}
+			if (!quoted && (line[i] == ' ' || line[i] == '\t'))
+				break;
+			if (line[i] == '\\' && i + 1 < line.size() &&
+			    line[i + 1] == '"') {
+				comment = true;
+				break;
+			}
+			if (line[i] == '\\')
+				i += Unescape(line, i, token);
+			else
+				token.push_back(line[i++]);
+		}
+		if (!token.empty() || quoted)
+			tokens.push_back(token);
+	}
+
+	return tokens;
+}
+
+/*
+ * Inserts "node" in the syntax tree at the position tracked by "stack",
+ * i.e. the path from the root to the innermost open block.
+ */
+static void
+Insert(std::vector<mdoc::Node *>& stack, mdoc::Node& node)
+{
+	size_t depth = stack.size();
+	bool block = false;
+
+	if (node.macro == "Sh") {
+		stack.resize(1);
+		block = true;
+	} else if (node.macro == "Bl") {
+		block = true;
+	} else if (node.macro == "It" || node.macro == "El") {
+		/* Look up the innermost open list. */
+		while (depth > 1 && stack[depth - 1]->macro != "Bl")
+			depth--;
+		if (depth > 1 && node.macro == "El") {
+			stack.resize(depth - 1);
+			return;
+		} else if (depth > 1) {
+			stack.resize(depth);
+			block = true;
+		}
+	}
+
+	stack.back()->children.push_back(std::move(node));
+	if (block)
+		stack.push_back(&stack.back()->children.back());
+}
+
+/* Returns the last source line within the subtree of "node". */
+static boost::string_view
+LastLine(const mdoc::Node& node)
+{
+	return node.children.empty() ? node.line
+				     : LastLine(node.children.back());
+}
+
+/*
+ * Returns the source of the body of the block "node", i.e. the lines
+ * between its own line and its closing, which are contiguous in the page.
+ */
+static boost::string_view
+Body(const mdoc::Node& node)
+{
+	boost::string_view first;
+	boost::string_view last;
+
+	if (node.children.empty())
+		return boost::string_view();
+
+	first = node.children.front().line;
+	last = LastLine(node);
+	return boost::string_view(first.data(),
+				  last.data() + last.size() - first.data());
+}
+
+/*
+ * Extracts the flags (.Fl) called from the macro line "node", along with
+ * their arguments (.Ar), into "options". A flag made of several letters
+ * which takes no argument is split into an option per letter if "split"
+ * is set, as in ".Op Fl abc". The flags are assigned to the optional
+ * groups tracked by "groups".
+ */
+static void
+Flags(const mdoc::Node& node,
+      bool split,
+      Groups& groups,
+      std::vector<mdoc::Option>& options)
+{
+	std::vector<mdoc::Option> found;
+	std::vector<std::string> tokens(1, node.macro);
+	std::string macro;
+	mdoc::Option option;
+	int group = groups.open;
+	size_t i;
+
+	tokens.insert(tokens.end(), node.args.begin(), node.args.end());
+	for (i = 0; i < tokens.size(); i++) {
+		if (!i || callable.count(tokens[i])) {
+			macro = tokens[i];
+			if (macro == "Op") {
+				group = ++groups.last;
+			} else if (macro == "Oo") {
+				group = groups.open = ++groups.last;
+			} else if (macro == "Oc") {
+				group = groups.open = -1;
+			}
+			continue;
+		}
+		if (delimiters.count(tokens[i]))
+			continue;
+
+		if (macro == "Fl") {
+			option = mdoc::Option();
+			option.name = tokens[i];
+			option.group = group;
+			found.push_back(option);
+		} else if (macro == "Ar" && !found.empty()) {
+			found.back().arguments.push_back(tokens[i]);
+		}
+	}
+
+	for (auto &i : found) {
+		if (!split || i.name.size() < 2 || i.name[0] == '-' ||
+		    !i.arguments.empty()) {
+			options.push_back(i);
+			continue;
+		}
+		for (const auto &c : i.name) {
+			option = i;
+			option.name = std::string(1, c);
+			options.push_back(option);
+		}
+	}
+}
+
+/*
+ * Collects the options having a list item (.It Fl) in the subtree of
+ * "node" into "options", and the name of the utility into "name".
+ */
+static void
+Items(const mdoc::Node& node,
+      std::vector<mdoc::Option>& options,
+      std::string& name)
+{
+	std::vector<mdoc::Option> found;
+	Groups groups = { -1, -1 };
+	boost::string_view description;
+
+	for (const auto &i : node.children) {
+		if (name.empty() && i.macro == "Nm" && !i.args.empty())
+			name = i.args.front();
+		if (i.macro == "It" && !i.args.empty() && i.args.front() == "Fl") {
+			found.clear();
+			Flags(i, false, groups, found);
+			description = Body(i);
+			for (auto &j : found) {
+				j.group = -1;
+				j.listed = true;
+				j.description = description;
+				options.push_back(j);
+			}
+		}
+		Items(i, options, name);
+	}
+}
+
+/*
+ * Maps the manual page located at "path" into the source of "page".
+ * Returns false if the page couldn't be read.
+ */
+bool
+mdoc::Load(std::string path, Page& page)
+{
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if ((fd = open(path.c_str(), O_RDONLY | O_CLOEXEC)) == -1)
+		return false;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+
+	/*
+	 * The page is mapped rather than read so that the lines of the tree
+	 * and the descriptions of the options can be views of its source.
+	 */
+	page.source.reset();
+	page.text = boost::string_view();
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			return false;
+		size = st.st_size;
+		page.source.reset((const char *)map, [size](const char *p) {
+			munmap((void *)p, size);
+		});
+		page.text = boost::string_view(page.source.get(), size);
+	} else {
+		close(fd);
+	}
+
+	return true;
+}
+
+/* Parses the source of "page" (see Load()) into its tree and options. */
+void
+mdoc::Parse(Page& page)
+{
+	std::vector<Node *> stack(1, &page.root);
+	std::vector<Option> listed;
+	std::vector<Option> synopsis;
+	std::unordered_map<std::string, size_t> index;
+	std::unordered_map<std::string, size_t>::iterator it;
+	Groups groups = { -1, -1 };
+	const char *data = page.text.data();
+	const char *end = data + page.text.size();
+	const char *eol;
+	Node node;
+
+	/*
+	 * Lines starting with a control character ('.' or '\'') are macro
+	 * lines, the rest are text lines. Only the former are tokenized,
+	 * hence the lines are delimited with memchr(3), which is vectorized
+	 * by libc, instead of scanned a character at a time.
+	 */
+	for (; data < end; data = eol + 1) {
+		if ((eol = (const char *)memchr(data, '\n', end - data)) == NULL)
+			eol = end;
+		node = Node();
+		node.line = boost::string_view(data, eol - data);
+		if (!node.line.empty() &&
+		    (node.line[0] == '.' || node.line[0] == '\'')) {
+			node.args = Tokenize(node.line.substr(1));
+			if (node.args.empty())
+				continue;  /* Comment or empty request. */
+			node.macro = node.args.front();
+			node.args.erase(node.args.begin());
+		}
+		Insert(stack, node);
+	}
+
+	Items(page.root, listed, page.name);
+	for (const auto &i : page.root.children) {
+		if (i.macro != "Sh" || i.args.size() != 1 ||
+		    i.args.front() != "SYNOPSIS")
+			continue;
+		for (const auto &j : i.children) {
+			if (!j.macro.empty())
+				Flags(j, true, groups, synopsis);
+		}
+	}
+
+	/* Merge the options found in SYNOPSIS into the listed ones. */
+	for (auto &i : listed) {
+		if (index.insert(std::make_pair(i.name,
+						page.options.size())).second)
+			page.options.push_back(std::move(i));
+	}
+	for (auto &i : synopsis) {
+		if ((it = index.find(i.name)) == index.end()) {
+			index[i.name] = page.options.size();
+			page.options.push_back(std::move(i));
+			continue;
+		}
+		Option& option = page.options[it->second];
+		if (option.group == -1)
+			option.group = i.group;
+		if (option.arguments.empty())
+			option.arguments = i.arguments;
+	}
+}
+
+/*
+ * Parses the manual page located at "path" into "page". Returns false
+ * if the page couldn't be read.
+ */
+bool
+mdoc::Parse(std::string path, Page& page)
+{
+	if (!Load(path, page))
+		return false;
+	Parse(page);
+
+	return true;
+}
@@ -0,0 +1,86 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _MDOC_H_
+#define _MDOC_H_
+
+#include <boost/utility/string_view.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mdoc {
+	/*
+	 * A node of the syntax tree of a manual page written in mdoc(7).
+	 * Sections (.Sh), lists (.Bl ... .El) and list items (.It) are
+	 * blocks, the body of which is made of their children. Every other
+	 * line is a leaf. The source lines refer to the mapped page (see
+	 * Page::source).
+	 */
+	struct Node {
+		std::string macro;  /* Name of the macro, or empty for text. */
+		std::vector<std::string> args;  /* Arguments of the macro. */
+		boost::string_view line;  /* Source line. */
+		std::vector<Node> children;
+	};
+
+	/* An option of a utility, as documented in its manual page. */
+	struct Option {
+		std::string name;   /* Name (without the leading '-'). */
+		std::vector<std::string> arguments;  /* Names of its arguments (.Ar). */
+		/* Index of its optional group (.Op) in SYNOPSIS, or -1. */
+		int group;
+		bool listed;        /* Whether it has a list item (.It Fl). */
+		/* Body of its list item, within the mapped page. */
+		boost::string_view description;
+
+		Option() : group(-1), listed(false) {}
+	};
+
+	/* A parsed manual page. */
+	struct Page {
+		/* Contents of the page, mapped for as long as the page lives. */
+		std::shared_ptr<const char> source;
+		boost::string_view text;  /* View of the whole "source". */
+		std::string name;   /* Name of the utility (.Nm). */
+		Node root;          /* Root of the syntax tree. */
+		/*
+		 * Options of the utility, i.e. the options having a list item
+		 * (in the order of the items), followed by the options only
+		 * found in SYNOPSIS.
+		 */
+		std::vector<Option> options;
+	};
+
+	std::vector<std::string> Tokenize(boost::string_view);
+	bool Load(std::string, Page&);
+	void Parse(Page&);
+	bool Parse(std::string, Page&);
+}
+
+#endif  /* _MDOC_H_ */
@@ -0,0 +1,358 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
+#include "logging.h"
+#include "option_index.h"
+#include "utils.h"
+
+/* File (inside the tool's directory) holding the index. */
+#define INDEXFILE "option_index"
+#define MAGIC "smoketest-options 1\n"
+
+bool optindex::enabled = true;
+
+/* Descriptor of the index, in append mode, shared by all the workers. */
+static int indexfd = -1;
+/* Mapping of the index as it was when it was opened. */
+static const char *mapping = NULL;
+static size_t mapsize = 0;
+/* Map utility name to its latest record within "mapping". */
+static std::unordered_map<std::string, const char *> records;
+
+/*
+ * Reads the fields of a record (see Encode()) in turn, failing past the
+ * end of the record. The fields are in host byte order and unaligned.
+ */
+struct Reader {
+	const char *data;
+	const char *end;
+
+	template <typename T>
+	bool
+	Get(T& value)
+	{
+		if ((size_t)(end - data) < sizeof(value))
+			return false;
+		memcpy(&value, data, sizeof(value));
+		data += sizeof(value);
+		return true;
+	}
+
+	bool
+	Get(std::string& value)
+	{
+		uint16_t length;
+
+		if (!Get(length) || (size_t)(end - data) < length)
+			return false;
+		value.assign(data, length);
+		data += length;
+		return true;
+	}
+};
+
+template <typename T>
+static void
+Put(std::string& record, T value)
+{
+	record.append((const char *)&value, sizeof(value));
+}
+
+static void
+Put(std::string& record, const std::string& value)
+{
+	Put(record, (uint16_t)value.size());
+	record += value;
+}
+
+/*
+ * Encodes the options of "page", the manual page of "utility", into a
+ * record, laid out as ~
+ *   <record size (u32)> <page hash (u64)> <page size (u64)>
+ *   <utility> <name of the page> <number of options (u32)>
+ *   <option>...
+ * with each option laid out as ~
+ *   <name> <group (i32)> <listed (u8)>
+ *   <description offset (u32)> <description length (u32)>
+ *   <number of arguments (u16)> <argument>...
+ * where a string is its length (u16) followed by its characters, and
+ * the description is located within the page.
+ */
+static std::string
+Encode(std::string utility, uint64_t hash, const mdoc::Page& page)
+{
+	std::string record;
+	uint32_t size;
+
+	Put(record, (uint32_t)0);
+	Put(record, hash);
+	Put(record, (uint64_t)page.text.size());
+	Put(record, utility);
+	Put(record, page.name);
+	Put(record, (uint32_t)page.options.size());
+	for (const auto &i : page.options) {
+		Put(record, i.name);
+		Put(record, (int32_t)i.group);
+		Put(record, (uint8_t)i.listed);
+		Put(record, (uint32_t)(i.description.empty() ? 0 :
+				       i.description.data() - page.text.data()));
+		Put(record, (uint32_t)i.description.size());
+		Put(record, (uint16_t)i.arguments.size());
+		for (const auto &j : i.arguments)
+			Put(record, j);
+	}
+	size = record.size();
+	memcpy(&record[0], &size, sizeof(size));
+
+	return record;
+}
+
+/*
+ * Decodes the options of "page" from "record" (see Encode()), provided
+ * that it was made from the current contents of the page, the hash of
+ * which is "hash". Returns false otherwise.
+ */
+static bool
+Decode(const char *record, uint64_t hash, mdoc::Page& page)
+{
+	Reader reader = { record, record };
+	std::string utility;
+	mdoc::Option option;
+	uint32_t size;
+	uint64_t value;
+	uint32_t count;
+	uint32_t offset;
+	uint32_t length;
+	uint16_t arguments;
+	int32_t group;
+	uint8_t listed;
+
+	reader.end = record + sizeof(size);
+	if (!reader.Get(size))
+		return false;
+	reader.end = record + size;
+	if (!reader.Get(value) || value != hash ||
+	    !reader.Get(value) || value != page.text.size() ||
+	    !reader.Get(utility) || !reader.Get(page.name) ||
+	    !reader.Get(count))
+		return false;
+
+	while (count--) {
+		option = mdoc::Option();
+		if (!reader.Get(option.name) || !reader.Get(group) ||
+		    !reader.Get(listed) || !reader.Get(offset) ||
+		    !reader.Get(length) || !reader.Get(arguments) ||
+		    (uint64_t)offset + length > page.text.size())
+			return false;
+		option.group = group;
+		option.listed = listed;
+		option.description = page.text.substr(offset, length);
+		option.arguments.resize(arguments);
+		for (auto &i : option.arguments) {
+			if (!reader.Get(i))
+				return false;
+		}
+		page.options.push_back(std::move(option));
+	}
+
+	return true;
+}
+
+/*
+ * Rewrites the index with only the latest record of each utility, as
+ * the index otherwise keeps growing with every change of a page.
+ */
+static void
+Compact()
+{
+	std::string path = INDEXFILE;
+	std::string tmppath = path + "." + std::to_string(getpid());
+	std::string data = MAGIC;
+	uint32_t size;
+	int fd;
+
+	for (const auto &i : records) {
+		memcpy(&size, i.second, sizeof(size));
+		data.append(i.second, size);
+	}
+
+	fd = open(tmppath.c_str(),
+		  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		logging::LogPerror("open()");
+		return;
+	}
+	if (write(fd, data.data(), data.size()) != (ssize_t)data.size() ||
+	    rename(tmppath.c_str(), path.c_str())) {
+		logging::LogPerror("rename()");
+		unlink(tmppath.c_str());
+		close(fd);
+		return;
+	}
+
+	/* The records stay valid since the old index remains mapped. */
+	close(indexfd);
+	indexfd = fd;
+}
+
+/*
+ * Opens the index (creating it if needed) and maps it, so that the
+ * manual pages whose contents haven't changed since they were indexed
+ * aren't parsed again. Like the transcript, the descriptor is opened
+ * in append mode before the workers are forked.
+ */
+void
+optindex::Open()
+{
+	const size_t magiclen = strlen(MAGIC);
+	struct stat sb;
+	const char *data;
+	const char *end;
+	uint32_t size;
+	uint64_t hash;
+	size_t count = 0;
+	std::string utility;
+	Reader reader;
+	void *map;
+
+	if (!enabled)
+		return;
+
+	indexfd = open(INDEXFILE,
+		       O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (indexfd == -1 || fstat(indexfd, &sb) == -1) {
+		logging::LogPerror("open()");
+		Close();
+		return;
+	}
+
+	if ((size_t)sb.st_size > magiclen) {
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+			   indexfd, 0);
+		if (map != MAP_FAILED) {
+			mapping = (const char *)map;
+			mapsize = sb.st_size;
+		}
+	}
+
+	/* An index which can't be read is started over. */
+	if (mapping == NULL || memcmp(mapping, MAGIC, magiclen) != 0) {
+		if (ftruncate(indexfd, 0) == -1 ||
+		    write(indexfd, MAGIC, magiclen) != (ssize_t)magiclen) {
+			logging::LogPerror("write()");
+			Close();
+		}
+		return;
+	}
+
+	/*
+	 * A later record of a utility supersedes the earlier ones. A
+	 * truncated record (e.g. if the tool was interrupted) ends the
+	 * index.
+	 */
+	end = mapping + mapsize;
+	for (data = mapping + magiclen; data < end; data += size, count++) {
+		reader.data = data;
+		reader.end = end;
+		if (!reader.Get(size) || size < sizeof(size) ||
+		    size > (size_t)(end - data))
+			break;
+		reader.end = data + size;
+		if (!reader.Get(hash) || !reader.Get(hash) ||
+		    !reader.Get(utility))
+			break;
+		records[utility] = data;
+	}
+	if (data != end || count > records.size())
+		Compact();
+}
+
+/*
+ * Parses the manual page located at "path", i.e. the one of "utility",
+ * into "page". Unless the page has changed since it was indexed, its
+ * options are taken from the index instead, in which case the syntax
+ * tree of the page is left empty. Returns false if the page couldn't be
+ * read.
+ */
+bool
+optindex::Parse(std::string utility, std::string path, mdoc::Page& page)
+{
+	std::unordered_map<std::string, const char *>::iterator it;
+	std::string record;
+	uint64_t hash;
+
+	if (!mdoc::Load(path, page))
+		return false;
+	if (indexfd == -1) {
+		mdoc::Parse(page);
+		return true;
+	}
+
+	hash = utils::Hash(page.text.data(), page.text.size());
+	if ((it = records.find(utility)) != records.end()) {
+		if (Decode(it->second, hash, page))
+			return true;
+		page.name.clear();
+		page.options.clear();
+	}
+
+	mdoc::Parse(page);
+	record = Encode(utility, hash, page);
+	/* A single write(2) keeps the records of the workers apart. */
+	if (write(indexfd, record.data(), record.size()) !=
+	    (ssize_t)record.size())
+		logging::LogPerror("write()");
+
+	return true;
+}
+
+void
+optindex::Close()
+{
+	if (indexfd != -1) {
+		close(indexfd);
+		indexfd = -1;
+	}
+	if (mapping != NULL) {
+		munmap((void *)mapping, mapsize);
+		mapping = NULL;
+		mapsize = 0;
+	}
+	records.clear();
+}
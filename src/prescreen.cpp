@@ -0,0 +1,203 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <unordered_set>
+
+#include "logging.h"
+#include "prescreen.h"
+#include "utils.h"
+
+bool prescreen::enabled = true;
+
+/*
+ * Functions whose import marks a utility as (likely) interactive, i.e.
+ * terminal handling, password prompts, and the curses and line editing
+ * libraries.
+ */
+static const std::unordered_set<std::string> interactive_symbols = {
+	"tcgetattr", "tcsetattr", "cfmakeraw", "readpassphrase", "getpass",
+	"initscr", "newterm", "setupterm", "tgetent", "el_init", "readline"
+};
+
+/* Utilities found to be interactive by Scan(). */
+static std::unordered_set<std::string> interactive;
+
+/*
+ * Returns whether the ELF image "image" of "size" bytes imports any of
+ * the "interactive_symbols", i.e. whether its dynamic symbol table has
+ * an undefined symbol by that name.
+ */
+template <typename Ehdr, typename Shdr, typename Sym>
+static bool
+ImportsInteractive(const char *image, size_t size)
+{
+	const Ehdr *ehdr = (const Ehdr *)image;
+	const Shdr *shdr;
+	const Shdr *strtab;
+	const Sym *sym;
+	const char *name;
+	size_t nsyms;
+	size_t i;
+	size_t j;
+
+	if (size < sizeof(Ehdr) || ehdr->e_shoff == 0 ||
+	    ehdr->e_shentsize != sizeof(Shdr) || ehdr->e_shoff > size ||
+	    ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(Shdr))
+		return false;
+
+	shdr = (const Shdr *)(image + ehdr->e_shoff);
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type != SHT_DYNSYM ||
+		    shdr[i].sh_link >= ehdr->e_shnum)
+			continue;
+		strtab = &shdr[shdr[i].sh_link];
+		if (shdr[i].sh_offset > size ||
+		    shdr[i].sh_size > size - shdr[i].sh_offset ||
+		    strtab->sh_offset > size ||
+		    strtab->sh_size > size - strtab->sh_offset)
+			return false;
+
+		sym = (const Sym *)(image + shdr[i].sh_offset);
+		nsyms = shdr[i].sh_size / sizeof(Sym);
+		for (j = 0; j < nsyms; j++) {
+			if (sym[j].st_shndx != SHN_UNDEF ||
+			    sym[j].st_name >= strtab->sh_size)
+				continue;
+			name = image + strtab->sh_offset + sym[j].st_name;
+			if (interactive_symbols.count(std::string(name,
+			    strnlen(name, strtab->sh_size - sym[j].st_name))))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Returns whether the binary located at "path" is an ELF executable
+ * of the host's byte order which imports any of the
+ * "interactive_symbols". Scripts and static executables never do.
+ */
+static bool
+InspectBinary(std::string path)
+{
+	static const uint16_t one = 1;
+	const char *image;
+	struct stat sb;
+	bool found = false;
+	int fd;
+
+	if (path.empty() || (fd = open(path.c_str(), O_RDONLY)) == -1)
+		return false;
+	if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < EI_NIDENT) {
+		close(fd);
+		return false;
+	}
+	image = (const char *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return false;
+
+	if (!memcmp(image, ELFMAG, SELFMAG) &&
+	    image[EI_DATA] == (*(const char *)&one ? ELFDATA2LSB
+						    : ELFDATA2MSB)) {
+		if (image[EI_CLASS] == ELFCLASS64)
+			found = ImportsInteractive<Elf64_Ehdr, Elf64_Shdr,
+			    Elf64_Sym>(image, sb.st_size);
+		else if (image[EI_CLASS] == ELFCLASS32)
+			found = ImportsInteractive<Elf32_Ehdr, Elf32_Shdr,
+			    Elf32_Sym>(image, sb.st_size);
+	}
+
+	munmap((void *)image, sb.st_size);
+	return found;
+}
+
+/*
+ * Inspects the binaries of "utilities", marking the ones which import
+ * functions used for interacting with a terminal as interactive (see
+ * Interactive()). The binaries are inspected by a thread per online
+ * processor.
+ */
+void
+prescreen::Scan(const std::vector<std::string>& utilities)
+{
+	std::vector<std::thread> threads;
+	std::vector<char> found(utilities.size(), 0);
+	std::atomic<size_t> next(0);
+	unsigned int nthreads;
+	size_t i;
+
+	if (!enabled)
+		return;
+
+	nthreads = std::max(1U, std::thread::hardware_concurrency());
+	nthreads = std::min((size_t)nthreads, utilities.size());
+	for (i = 0; i < nthreads; i++) {
+		threads.emplace_back([&]() {
+			size_t index;
+
+			while ((index = next++) < utilities.size()) {
+				found[index] = InspectBinary(utils::LookupUtility
+							     (utilities[index]));
+			}
+		});
+	}
+	for (auto &i : threads)
+		i.join();
+
+	for (i = 0; i < utilities.size(); i++) {
+		if (found[i]) {
+			DEBUGP("Interactive: %s\n", utilities[i].c_str());
+			interactive.insert(utilities[i]);
+		}
+	}
+}
+
+/*
+ * Returns whether "utility" was found to be interactive by Scan(), in
+ * which case its commands are likely to block waiting for user input.
+ */
+bool
+prescreen::Interactive(std::string utility)
+{
+	return interactive.find(utility) != interactive.end();
+}
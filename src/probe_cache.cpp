@@ -0,0 +1,311 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "fetch_groff.h"
+#include "logging.h"
+#include "probe_cache.h"
+#include "utils.h"
+
+/* Directory (inside the tool's directory) holding the cached results. */
+#define CACHEDIR "probe_cache"
+#define MAGIC "smoketest-probe 5"
+
+bool probecache::enabled = true;
+
+/* Map utility name to the fingerprint of its binary and groff script. */
+static std::unordered_map<std::string, uint64_t> fingerprints;
+
+/*
+ * Computes the fingerprint of a utility, i.e. the hash of its binary
+ * and of its groff script. A change in either of these invalidates all
+ * the cached results of the utility.
+ */
+uint64_t
+probecache::Fingerprint(std::string utility)
+{
+	std::unordered_map<std::string, uint64_t>::iterator it;
+	std::unordered_map<std::string, std::string>::iterator groff;
+	uint64_t hash;
+
+	if ((it = fingerprints.find(utility)) != fingerprints.end())
+		return it->second;
+
+	hash = utils::HashFile(utils::LookupUtility(utility));
+	if ((groff = groff::groff_map.find(utility)) != groff::groff_map.end())
+		hash = utils::HashFile(groff->second, hash);
+	fingerprints[utility] = hash;
+
+	return hash;
+}
+
+/*
+ * Computes the digest of the fixture (see utils::fixture), i.e. the hash
+ * of the paths of its entries (in order) along with the contents of its
+ * files and the targets of its symbolic links.
+ */
+static uint64_t
+FixtureDigest()
+{
+	boost::filesystem::recursive_directory_iterator it, end;
+	boost::system::error_code ec;
+	std::vector<std::string> entries;
+	std::string target;
+	uint64_t hash;
+
+	hash = utils::Hash(utils::fixture.data(), utils::fixture.size());
+	for (it = boost::filesystem::recursive_directory_iterator
+			(utils::fixture, ec); it != end; it.increment(ec)) {
+		if (ec)
+			break;
+		entries.push_back(it->path().string());
+	}
+	std::sort(entries.begin(), entries.end());
+
+	for (const auto &i : entries) {
+		hash = utils::Hash(i.data(), i.size() + 1, hash);
+		if (boost::filesystem::is_symlink(i)) {
+			target = boost::filesystem::read_symlink(i, ec).string();
+			hash = utils::Hash(target.data(), target.size(), hash);
+		} else if (boost::filesystem::is_regular_file(i)) {
+			hash = utils::HashFile(i, hash);
+		}
+	}
+
+	return hash;
+}
+
+/*
+ * Returns the setting which the results of all the commands of this
+ * run depend on besides their keys (see utils::ProbeKey()), i.e. the
+ * full budget and the fixture (if any), which is appended to the keys
+ * of the cached results.
+ */
+static const std::string&
+Setting()
+{
+	static std::string setting;
+
+	if (!setting.empty())
+		return setting;
+
+	setting.push_back('\0');
+	setting += "timeout=" + std::to_string(utils::timeout);
+	if (!utils::fixture.empty()) {
+		setting.push_back('\0');
+		setting += "fixture=" + utils::fixture + ":"
+			 + std::to_string(FixtureDigest());
+	}
+
+	return setting;
+}
+
+/*
+ * Returns the path of the file caching the result of the command
+ * (executing "utility") identified by "key" (see utils::ProbeKey()).
+ */
+static std::string
+CachePath(std::string key, std::string utility)
+{
+	uint64_t hash = probecache::Fingerprint(utility);
+	char name[17];
+
+	hash = utils::Hash(key.data(), key.size(), hash);
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+
+	return std::string(CACHEDIR) + "/" + utility + "-" + name;
+}
+
+/*
+ * Reads a result (see Write()) from "file" into "key" and "output".
+ * Returns false if the result couldn't be read.
+ */
+bool
+probecache::Read(std::istream& file,
+		 std::string& key,
+		 utils::ProbeResult& output)
+{
+	size_t keylen;
+	size_t outlen;
+	size_t errlen;
+
+	if (!(file >> keylen >> output.exitstatus >> output.termsig
+		   >> output.timedout >> output.interactive >> output.duration
+		   >> output.outsize >> output.outdigest
+		   >> output.errsize >> output.errdigest >> outlen >> errlen) ||
+	    file.get() != '\n')
+		return false;
+
+	key.resize(keylen);
+	output.out.resize(outlen);
+	output.err.resize(errlen);
+	if (!file.read(&key[0], keylen) ||
+	    !file.read(&output.out[0], outlen) ||
+	    !file.read(&output.err[0], errlen)) {
+		output = utils::ProbeResult();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Writes the result "output" of the command identified by "key" to
+ * "file", laid out as ~
+ *   <key length> <exit status> <signal> <timed out> <interactive>
+ *   <duration (ms)>
+ *   <stdout size> <stdout digest> <stderr size> <stderr digest>
+ *   <stdout length> <stderr length>\n
+ *   <key><stdout><stderr>
+ */
+void
+probecache::Write(std::ostream& file,
+		  const std::string& key,
+		  const utils::ProbeResult& output)
+{
+	file << key.size() << " " << output.exitstatus << " "
+	     << output.termsig << " " << output.timedout << " "
+	     << output.interactive << " "
+	     << output.duration << " " << output.outsize << " "
+	     << output.outdigest << " " << output.errsize << " "
+	     << output.errdigest << " " << output.out.size() << " "
+	     << output.err.size() << "\n";
+	file.write(key.data(), key.size());
+	file.write(output.out.data(), output.out.size());
+	file.write(output.err.data(), output.err.size());
+}
+
+/*
+ * Looks up the persisted result of the command executing "utility"
+ * (identified by "key") in the setting of this run (see Setting()).
+ * Returns true if a result was found, in which case it is stored in
+ * "output".
+ */
+bool
+probecache::Lookup(std::string key,
+		   std::string utility,
+		   utils::ProbeResult& output)
+{
+	std::ifstream file;
+	std::string magic;
+	std::string cached_key;
+
+	if (!enabled)
+		return false;
+
+	key += Setting();
+	file.open(CachePath(key, utility), std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	/* Each cache file is laid out as "MAGIC\n" followed by the result. */
+	if (!std::getline(file, magic) || magic != MAGIC ||
+	    !Read(file, cached_key, output))
+		return false;
+	if (cached_key != key || output.timedout) {
+		output = utils::ProbeResult();
+		return false;
+	}
+
+	/* The cached output must not have been truncated below the limit. */
+	if ((output.out.size() < output.outsize &&
+	     output.out.size() < utils::max_output) ||
+	    (output.err.size() < output.errsize &&
+	     output.err.size() < utils::max_output)) {
+		output = utils::ProbeResult();
+		return false;
+	}
+	if (output.out.size() > utils::max_output)
+		output.out.resize(utils::max_output);
+	if (output.err.size() > utils::max_output)
+		output.err.resize(utils::max_output);
+	DEBUGP("Cached: %s, exit status: %d\n", utility.c_str(),
+	       output.exitstatus);
+
+	return true;
+}
+
+/*
+ * Persists the result of the command executing
+ * "utility" (identified by "key"). A command which ran out
+ * of its budget isn't persisted, since it might complete
+ * in a later run (see timing::Stuck()).
+ */
+void
+probecache::Store(std::string key,
+		  std::string utility,
+		  utils::ProbeResult& output)
+{
+	std::ofstream file;
+	std::string path;
+	std::string tmppath;
+	struct stat sb;
+
+	if (!enabled || output.timedout)
+		return;
+
+	key += Setting();
+	if (stat(CACHEDIR, &sb) && mkdir(CACHEDIR, 0755) && errno != EEXIST) {
+		logging::LogPerror("mkdir()");
+		return;
+	}
+
+	/*
+	 * Multiple workers might be storing results at the same time,
+	 * hence the file is written under a temporary name first and
+	 * then atomically renamed.
+	 */
+	path = CachePath(key, utility);
+	tmppath = path + "." + std::to_string(getpid());
+	file.open(tmppath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		logging::LogPerror("open()");
+		return;
+	}
+
+	file << MAGIC << "\n";
+	Write(file, key, output);
+	file.close();
+
+	if (file.fail() || rename(tmppath.c_str(), path.c_str())) {
+		logging::LogPerror("rename()");
+		unlink(tmppath.c_str());
+	}
+}
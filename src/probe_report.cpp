@@ -0,0 +1,105 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "logging.h"
+#include "probe_report.h"
+#include "utils.h"
+
+std::string probereport::path = "probe_report";
+
+/* Descriptor of the report, shared by all the workers. */
+static int reportfd = -1;
+
+/*
+ * Creates (or truncates) the report and writes its header. Since the
+ * descriptor is opened in append mode before the workers are forked,
+ * each record written by a worker lands intact at the end of the file.
+ */
+void
+probereport::Open()
+{
+	std::string header = "utility\tstatus\twall_ms\tuser_ms\tsys_ms\t"
+			     "maxrss_kb\tminflt\tmajflt\tcommand\n";
+
+	reportfd = open(path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (reportfd == -1) {
+		logging::LogPerror("open()");
+		return;
+	}
+	if (write(reportfd, header.data(), header.size()) == -1)
+		logging::LogPerror("write()");
+}
+
+/* Appends the resource usage of an executed command to the report. */
+void
+probereport::Record(const std::vector<std::string>& command,
+		    const utils::ProbeResult& output)
+{
+	std::string record;
+	std::string status;
+
+	if (reportfd == -1)
+		return;
+
+	if (output.timedout)
+		status = "timeout";
+	else if (output.interactive)
+		status = "interactive";
+	else if (output.termsig)
+		status = "signal:" + std::to_string(output.termsig);
+	else
+		status = "exit:" + std::to_string(output.exitstatus);
+
+	record = command.front() + "\t" + status + "\t"
+	       + std::to_string(output.duration) + "\t"
+	       + std::to_string(output.utime) + "\t"
+	       + std::to_string(output.stime) + "\t"
+	       + std::to_string(output.maxrss) + "\t"
+	       + std::to_string(output.minflt) + "\t"
+	       + std::to_string(output.majflt) + "\t"
+	       + utils::CommandString(command) + "\n";
+
+	/* A single write(2) keeps the records of the workers apart. */
+	if (write(reportfd, record.data(), record.size()) == -1)
+		logging::LogPerror("write()");
+}
+
+void
+probereport::Close()
+{
+	if (reportfd != -1) {
+		close(reportfd);
+		reportfd = -1;
+	}
+}
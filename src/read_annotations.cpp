@@ -26,6 +26,7 @@
  * $FreeBSD$
  */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -52,6 +53,13 @@ annotations::read_annotations(std::string utility,
 		 */
 		else if (!line.compare(2, 4, "flag"))
 			annotation_set.insert(line.substr(0, 1));
+		/* Add "-name" for the testcase "long_name_flag" of '--name'. */
+		else if (line.size() > 10 && !line.compare(0, 5, "long_") &&
+			 !line.compare(line.size() - 5, 5, "_flag")) {
+			line = line.substr(4, line.size() - 9);
+			std::replace(line.begin(), line.end(), '_', '-');
+			annotation_set.insert(line);
+		}
 	}
 
 	file.close();
@@ -0,0 +1,288 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+
+#include "logging.h"
+#include "scratch.h"
+#include "utils.h"
+
+/* Number of trees renamed aside (used for naming them uniquely). */
+static unsigned long ntrash = 0;
+
+scratch::Pool::Pool(std::string root)
+	: root(root), ndirs(0), nstale(0), stopping(false)
+{
+}
+
+/* Waits for the background removal of the discarded trees. */
+scratch::Pool::~Pool()
+{
+	if (janitor.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_cv.notify_one();
+		janitor.join();
+	}
+}
+
+/*
+ * Returns the pool of the scratch directories inside "root", which is
+ * shared by all the commands executed by this process (each worker has
+ * a "root" of its own, see utils::workdir). The pools live until exit.
+ */
+scratch::Pool&
+scratch::Pool::Shared(const std::string& root)
+{
+	static std::unordered_map<std::string, std::unique_ptr<Pool>> pools;
+	std::unique_ptr<Pool>& pool = pools[root];
+
+	if (!pool)
+		pool.reset(new Pool(root));
+
+	return *pool;
+}
+
+/*
+ * Returns a directory which mirrors the fixture. A directory being reset
+ * in the background is waited for, rather than creating another one.
+ */
+std::string
+scratch::Pool::Acquire()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	std::string dir;
+	int error;
+
+	ready_cv.wait(lock, [this] { return !free_dirs.empty() || !nstale; });
+	if (!free_dirs.empty()) {
+		dir = std::move(free_dirs.back());
+		free_dirs.pop_back();
+		return dir;
+	}
+	lock.unlock();
+
+	/*
+	 * A directory which already exists has been left behind by a pool
+	 * of an earlier run, and is possibly modified, hence it is replaced
+	 * as well.
+	 */
+	dir = root + "/" + std::to_string(ndirs++);
+	if ((error = mkdir(dir.c_str(), 0755)) == -1 && errno == EEXIST) {
+		Discard(dir);
+		error = mkdir(dir.c_str(), 0755);
+	}
+	if (error == -1) {
+		logging::LogPerror("mkdir()");
+		exit(EXIT_FAILURE);
+	}
+	Populate(dir);
+
+	return dir;
+}
+
+/*
+ * Returns the directory "dir" to the pool, resetting it if the command
+ * executed inside it could have modified it. Without a fixture, an
+ * empty directory is left as it is, while a non-empty one is simply
+ * recreated. Otherwise, the fixture is mirrored anew in the background.
+ */
+void
+scratch::Pool::Release(const std::string& dir)
+{
+	boost::system::error_code ec;
+
+	if (!utils::fixture.empty()) {
+		Discard(dir);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stale.push_back(dir);
+			nstale++;
+		}
+		Wake();
+		return;
+	}
+
+	if (!boost::filesystem::is_empty(dir, ec) || ec) {
+		Discard(dir);
+		if (mkdir(dir.c_str(), 0755) == -1) {
+			logging::LogPerror("mkdir()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	free_dirs.push_back(dir);
+}
+
+/*
+ * Returns whether the file "path" of the fixture can be shared (i.e.
+ * hard-linked) among the scratch directories, which is the case if the
+ * commands can neither write to it nor change its attributes, i.e. it
+ * is neither owned by nor writable by us (and we are not the superuser).
+ */
+static bool
+Shareable(const boost::filesystem::path& path)
+{
+	struct stat sb;
+	uid_t euid = geteuid();
+
+	return euid != 0 && stat(path.c_str(), &sb) == 0 &&
+	    sb.st_uid != euid &&
+	    faccessat(AT_FDCWD, path.c_str(), W_OK, AT_EACCESS) == -1;
+}
+
+/*
+ * Mirrors the fixture inside "dir" as a "hardlink farm", i.e. the
+ * directories are recreated while the files are hard-linked. This
+ * is considerably cheaper than copying, however a command modifying
+ * a file in place (or its mode) would modify the fixture itself, hence
+ * only the files which the commands can't modify are hard-linked (see
+ * Shareable()), while the rest are copied.
+ */
+void
+scratch::Pool::Populate(const std::string& dir)
+{
+	boost::filesystem::recursive_directory_iterator it, end;
+	boost::filesystem::path target;
+	boost::system::error_code ec;
+	size_t prefixlen = utils::fixture.size();
+
+	if (utils::fixture.empty())
+		return;
+
+	for (it = boost::filesystem::recursive_directory_iterator
+			(utils::fixture, ec); it != end; it.increment(ec)) {
+		if (ec)
+			break;
+		target = dir + it->path().string().substr(prefixlen);
+		if (boost::filesystem::is_symlink(it->symlink_status()))
+			boost::filesystem::copy_symlink(it->path(), target, ec);
+		else if (boost::filesystem::is_directory(it->status()))
+			boost::filesystem::create_directory(target, ec);
+		else if (Shareable(it->path())) {
+			boost::filesystem::create_hard_link(it->path(), target,
+			    ec);
+			/* Hard links can't cross file systems, copy instead. */
+			if (ec && boost::filesystem::is_regular_file(
+			    it->status())) {
+				ec.clear();
+				boost::filesystem::copy_file(it->path(), target,
+				    ec);
+			}
+		} else
+			boost::filesystem::copy_file(it->path(), target, ec);
+		if (ec)
+			logging::LogPerror(it->path().c_str());
+	}
+}
+
+/*
+ * Renames "dir" aside and queues it for removal in the background,
+ * so that the pool needn't wait for a possibly large tree to be removed.
+ */
+void
+scratch::Pool::Discard(const std::string& dir)
+{
+	std::string aside = root + "/.trash." + std::to_string(ntrash++);
+
+	if (rename(dir.c_str(), aside.c_str()) == -1) {
+		/* Fallback to removing the tree right away. */
+		logging::LogPerror("rename()");
+		boost::filesystem::remove_all(dir);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		trash.push_back(aside);
+	}
+	Wake();
+}
+
+/* Wakes "janitor" up for the queued work, starting it on first use. */
+void
+scratch::Pool::Wake()
+{
+	work_cv.notify_one();
+	if (!janitor.joinable())
+		janitor = std::thread(&scratch::Pool::Tidy, this);
+}
+
+/*
+ * [Background thread] Recreates the stale slots (see Release()) and
+ * removes the discarded trees until stopped. The slots come first, as
+ * a command might be waiting for one.
+ */
+void
+scratch::Pool::Tidy()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	boost::system::error_code ec;
+	std::string path;
+	bool created;
+
+	for (;;) {
+		work_cv.wait(lock, [this] {
+			return stopping || !stale.empty() || !trash.empty();
+		});
+		if (!stale.empty() && !stopping) {
+			path = std::move(stale.front());
+			stale.pop_front();
+			lock.unlock();
+			/* A slot which can't be recreated is dropped. */
+			if ((created = mkdir(path.c_str(), 0755) == 0))
+				Populate(path);
+			else
+				logging::LogPerror("mkdir()");
+			lock.lock();
+			if (created)
+				free_dirs.push_back(path);
+			nstale--;
+			ready_cv.notify_one();
+		} else if (!trash.empty()) {
+			path = std::move(trash.front());
+			trash.pop_front();
+			lock.unlock();
+			boost::filesystem::remove_all(path, ec);
+			lock.lock();
+		} else {
+			return;
+		}
+	}
+}
@@ -0,0 +1,86 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace scratch {
+	/*
+	 * A pool of scratch directories (inside "root") in which the
+	 * commands are executed. A directory is handed out only when it
+	 * mirrors the fixture (see utils::fixture), i.e. is empty if no
+	 * fixture is in use. Returned directories are reset by renaming
+	 * them aside and mirroring the fixture anew (the files the commands
+	 * could modify are copied, the rest hard-linked). Both the removal
+	 * of the renamed trees and the mirroring are left to a background
+	 * thread, so that the commands needn't wait for either of them.
+	 * Slots left behind by a previous run are reset as well.
+	 * The pools are meant to be obtained via Shared(), so that the
+	 * directories are reused by all the batches of commands.
+	 */
+	class Pool {
+	public:
+		explicit Pool(std::string);
+		~Pool();
+
+		static Pool& Shared(const std::string&);
+		std::string Acquire();
+		void Release(const std::string&);
+
+	private:
+		std::string root;
+		size_t ndirs;  /* Number of scratch directories created. */
+
+		/* State shared with "janitor", guarded by "mutex". */
+		std::mutex mutex;
+		std::vector<std::string> free_dirs;
+		/* Slots to be recreated by "janitor". */
+		std::deque<std::string> stale;
+		size_t nstale;  /* Number of slots yet to be recreated. */
+		/* Renamed trees waiting to be removed by "janitor". */
+		std::deque<std::string> trash;
+		std::condition_variable work_cv;  /* Signals "janitor". */
+		std::condition_variable ready_cv;  /* Signals Acquire(). */
+		std::thread janitor;
+		bool stopping;
+
+		void Populate(const std::string&);
+		void Discard(const std::string&);
+		void Wake();
+		void Tidy();
+	};
+}
+
+#endif  /* _SCRATCH_H_ */
@@ -0,0 +1,163 @@
+#!/usr/bin/awk -f
+#
+# Copyright 2017-2018 Shivansh Rai
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+#
+# $FreeBSD$
+
+# Compiles the options with known semantics listed in "known_options"
+# into a C++ header, which is included by known_options.cpp.
+#
+# The options are laid out in a table indexed by a perfect hash of their
+# names, i.e. a hash which maps each of them to a distinct slot. The
+# hash is parametrized by a seed, which is searched for here, and is
+# computed exactly as knownopts::Hash() does.
+
+function hash(name, seed, size,    h, i)
+{
+	h = seed % size
+	for (i = 1; i <= length(name); i++)
+		h = (h * seed + ord[substr(name, i, 1)]) % size
+	return h
+}
+
+# Returns whether "seed" maps the options to distinct slots of a table
+# of "size" slots, which are then stored in "slot".
+function perfect(seed, size,    i, h, used)
+{
+	for (i = 0; i < noptions; i++) {
+		h = hash(options[i], seed, size)
+		if (h in used)
+			return 0
+		used[h] = 1
+		slot[h] = i
+	}
+	return 1
+}
+
+BEGIN {
+	FS = "\t+"
+	# The counters are used as subscripts, hence they must be numbers.
+	noptions = nkeywords = nsem = nids = 0
+	for (i = 32; i < 127; i++)
+		ord[sprintf("%c", i)] = i
+}
+
+/^#/ || NF == 0 {
+	next
+}
+
+NF != 3 {
+	printf("%s:%d: expected 3 fields\n", FILENAME, FNR) > "/dev/stderr"
+	exit 1
+}
+
+{
+	if (!($1 in index_of)) {
+		index_of[$1] = noptions
+		options[noptions] = $1
+		noptions++
+	}
+	# The semantics of an option are grouped together.
+	o = index_of[$1]
+	j = nsemantics[o]++
+	semantic[o, j] = $2
+	keywords[o, j] = ""
+	nkw = split($3, kw, ",")
+	for (i = 1; i <= nkw; i++) {
+		if (!(kw[i] in keyword_id)) {
+			keyword_id[kw[i]] = nkeywords
+			keyword[nkeywords] = kw[i]
+			nkeywords++
+		}
+		keywords[o, j] = keywords[o, j] " " keyword_id[kw[i]]
+	}
+}
+
+END {
+	if (noptions == 0)
+		exit 1
+
+	# The smallest table, with at least twice as many slots as there
+	# are options, for which a seed is found.
+	for (size = 2 * noptions; ; size++) {
+		for (seed = 1; seed < 4096; seed++) {
+			split("", slot)
+			if (perfect(seed, size))
+				break
+		}
+		if (seed < 4096)
+			break
+	}
+
+	name = FILENAME
+	sub(/.*\//, "", name)
+	printf("/* Generated from %s by known_options.awk, do not edit. */\n\n",
+	    name)
+	printf("#define KNOWN_SEED\t%d\n", seed)
+	printf("#define KNOWN_SLOTS\t%d\n\n", size)
+
+	printf("static constexpr const char *keywords[] = {\n")
+	for (i = 0; i < nkeywords; i++)
+		printf("\t\"%s\",\n", keyword[i])
+	printf("};\n\n")
+
+	# Lay out the semantics, and their keywords, option by option.
+	for (h = 0; h < size; h++) {
+		if (!(h in slot))
+			continue
+		o = slot[h]
+		first[o] = nsem
+		for (j = 0; j < nsemantics[o]; j++) {
+			n = split(keywords[o, j], ids, " ")
+			sem_name[nsem] = semantic[o, j]
+			sem_first[nsem] = nids
+			sem_count[nsem] = n
+			nsem++
+			for (i = 1; i <= n; i++)
+				id[nids++] = ids[i]
+		}
+	}
+
+	printf("static constexpr unsigned semantic_keywords[] = {")
+	for (i = 0; i < nids; i++)
+		printf("%s%s", (i % 12) ? " " : "\n\t", id[i] ",")
+	printf("\n};\n\n")
+
+	printf("static constexpr knownopts::Semantic semantics[] = {\n")
+	for (i = 0; i < nsem; i++)
+		printf("\t{ \"%s\", %d, %d },\n", sem_name[i], sem_first[i],
+		    sem_count[i])
+	printf("};\n\n")
+
+	printf("static constexpr knownopts::Option options[KNOWN_SLOTS] = {\n")
+	for (h = 0; h < size; h++) {
+		if (h in slot)
+			printf("\t{ \"%s\", %d, %d },\n", options[slot[h]],
+			    first[slot[h]], nsemantics[slot[h]])
+		else
+			printf("\t{ NULL, 0, 0 },\n")
+	}
+	printf("};\n")
+}
@@ -0,0 +1,101 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Checks that a command running out of the full budget is executed with
+ * the full budget again in the following runs, until it has done so
+ * STUCK_RUNS (see timing.cpp) times, after which it is fast-failed. The
+ * runs are simulated by forgetting the memoized results in between,
+ * while the probe cache and the timing history are persisted (inside a
+ * temporary directory) as usual.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+#include "utils.h"
+
+/* Full budget (milliseconds) of the commands. */
+#define TIMEOUT 500
+
+int
+main()
+{
+	char dir[] = "/tmp/timing_test.XXXXXX";
+	std::vector<std::vector<std::string>> commands;
+	std::vector<utils::ProbeResult> outputs;
+	std::ofstream utility;
+	int failures = 0;
+	int run;
+
+	if (mkdtemp(dir) == NULL || chdir(dir) == -1 ||
+	    mkdir(utils::tmpdir, 0755) == -1) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	/* A utility which never completes. */
+	utility.open("smokestuck");
+	utility << "#!/bin/sh\nsleep 10\n";
+	utility.close();
+	commands.push_back({ "sh", std::string(dir) + "/smokestuck" });
+
+	utils::timeout = TIMEOUT;
+	utils::grace = 100;
+	for (run = 1; run <= 3; run++) {
+		utils::ClearProbeCache();
+		outputs = utils::ExecuteBatch(commands, 1);
+		/* The first two runs are given the full budget. */
+		if (!outputs[0].timedout ||
+		    (outputs[0].duration < TIMEOUT) != (run == 3)) {
+			std::cerr << "run " << run << ": timed out: "
+				  << outputs[0].timedout << ", duration: "
+				  << outputs[0].duration << " ms\n";
+			failures++;
+		}
+		if (timing::Stuck("sh", utils::ProbeKey(commands[0])) !=
+		    (run >= 2)) {
+			std::cerr << "run " << run << ": "
+				  << (run >= 2 ? "not stuck" : "stuck") << "\n";
+			failures++;
+		}
+	}
+
+	boost::filesystem::remove_all(dir);
+	std::cout << (failures ? "FAIL" : "PASS") << "\n";
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
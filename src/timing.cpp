@@ -0,0 +1,262 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include "logging.h"
+#include "timing.h"
+#include "utils.h"
+
+/* Directory (inside the tool's directory) holding the timing history. */
+#define TIMINGDIR "probe_timings"
+#define MAGIC "smoketest-timing 1"
+/* Number of most recent durations retained per utility. */
+#define WINDOW 256
+/* Number of durations required before the budget is learned. */
+#define MIN_SAMPLES 8
+/* Factor applied to the 99th percentile of the durations. */
+#define FACTOR 4
+/* Lower bound (milliseconds) of a learned budget. */
+#define MIN_BUDGET 100
+/*
+ * Number of times a command must have run out of the full budget
+ * (without ever completing since) to be considered stuck.
+ */
+#define STUCK_RUNS 2
+
+bool timing::enabled = true;
+
+/* Timing history of a utility. */
+struct History {
+	bool loaded;
+	bool dirty;  /* Whether the history has changed since it was loaded. */
+	/* Durations (milliseconds) of the recently completed commands. */
+	std::vector<long> durations;
+	/*
+	 * Map the hash of a command's key (see utils::ProbeKey()) to the
+	 * number of times it has run out of the full budget.
+	 */
+	std::unordered_map<uint64_t, long> timeouts;
+	long budget;  /* Learned budget, or 0 if it is yet to be computed. */
+
+	History() : loaded(false), dirty(false), budget(0) {}
+};
+
+static std::unordered_map<std::string, History> histories;
+
+static std::string
+HistoryPath(std::string utility)
+{
+	return std::string(TIMINGDIR) + "/" + utility;
+}
+
+/*
+ * Returns the timing history of "utility", loading it from the
+ * previous runs of the tool on first use.
+ */
+static History&
+Lookup(std::string utility)
+{
+	History& history = histories[utility];
+	std::ifstream file;
+	std::string magic;
+	size_t count;
+	long duration;
+	uint64_t hash;
+	long timeouts;
+
+	if (history.loaded)
+		return history;
+	history.loaded = true;
+
+	file.open(HistoryPath(utility));
+	if (!file.is_open())
+		return history;
+
+	/*
+	 * Each history file is laid out as ~
+	 *   MAGIC\n
+	 *   <number of durations> <duration>...\n
+	 *   <number of stuck commands> <key hash> <timeouts>...\n
+	 */
+	if (!std::getline(file, magic) || magic != MAGIC || !(file >> count))
+		return history;
+	while (count-- && file >> duration)
+		history.durations.push_back(duration);
+	if (!(file >> count))
+		return history;
+	while (count-- && file >> hash >> timeouts)
+		history.timeouts[hash] = timeouts;
+
+	return history;
+}
+
+static uint64_t
+KeyHash(std::string key)
+{
+	return utils::Hash(key.data(), key.size());
+}
+
+/*
+ * Returns the wall-clock budget (milliseconds) of the command executing
+ * "utility" (identified by "key"), i.e. FACTOR times the 99th percentile
+ * of the durations of the commands previously executed for the utility,
+ * within [MIN_BUDGET, utils::timeout]. The full budget is used until
+ * enough durations have been recorded. A stuck command (see Stuck()) is
+ * fast-failed with a budget of MIN_BUDGET.
+ */
+long
+timing::Budget(std::string utility, std::string key)
+{
+	std::vector<long> durations;
+	size_t rank;
+
+	if (!enabled)
+		return utils::timeout;
+
+	History& history = Lookup(utility);
+	if (Stuck(utility, key))
+		return std::min((long)MIN_BUDGET, utils::timeout);
+	if (history.durations.size() < MIN_SAMPLES)
+		return utils::timeout;
+
+	if (!history.budget) {
+		durations = history.durations;
+		rank = durations.size() * 99 / 100;
+		std::nth_element(durations.begin(), durations.begin() + rank,
+				 durations.end());
+		history.budget = std::max((long)MIN_BUDGET,
+					  durations[rank] * FACTOR);
+	}
+
+	return std::min(history.budget, utils::timeout);
+}
+
+/*
+ * Returns whether the command executing "utility" (identified by "key")
+ * is stuck, i.e. it ran out of the full budget in the previous runs and
+ * never completed since. Such a command is not worth the full budget.
+ */
+bool
+timing::Stuck(std::string utility, std::string key)
+{
+	std::unordered_map<uint64_t, long>::iterator it;
+
+	if (!enabled)
+		return false;
+
+	History& history = Lookup(utility);
+	return (it = history.timeouts.find(KeyHash(key)))
+			!= history.timeouts.end() &&
+	       it->second >= STUCK_RUNS;
+}
+
+/*
+ * Records the result "output" of the command executing "utility"
+ * (identified by "key") which was given a budget of "budget"
+ * milliseconds.
+ */
+void
+timing::Record(std::string utility,
+	       std::string key,
+	       const utils::ProbeResult& output,
+	       long budget)
+{
+	if (!enabled)
+		return;
+
+	History& history = Lookup(utility);
+	if (!output.timedout) {
+		history.durations.push_back(output.duration);
+		if (history.durations.size() > WINDOW)
+			history.durations.erase(history.durations.begin());
+		history.timeouts.erase(KeyHash(key));
+		history.budget = 0;
+		history.dirty = true;
+	} else if (budget >= utils::timeout) {
+		history.timeouts[KeyHash(key)]++;
+		history.dirty = true;
+	}
+}
+
+/* Persists the timing histories which have changed. */
+void
+timing::Flush()
+{
+	std::ofstream file;
+	std::string path;
+	std::string tmppath;
+	struct stat sb;
+
+	if (!enabled)
+		return;
+
+	for (auto &it : histories) {
+		if (!it.second.dirty)
+			continue;
+		it.second.dirty = false;
+
+		if (stat(TIMINGDIR, &sb) && mkdir(TIMINGDIR, 0755) &&
+		    errno != EEXIST) {
+			logging::LogPerror("mkdir()");
+			return;
+		}
+
+		/* See probecache::Store() for the temporary file. */
+		path = HistoryPath(it.first);
+		tmppath = path + "." + std::to_string(getpid());
+		file.open(tmppath, std::ios::out | std::ios::trunc);
+		if (!file.is_open()) {
+			logging::LogPerror("open()");
+			continue;
+		}
+
+		file << MAGIC << "\n" << it.second.durations.size();
+		for (const auto &i : it.second.durations)
+			file << " " << i;
+		file << "\n" << it.second.timeouts.size();
+		for (const auto &i : it.second.timeouts)
+			file << " " << i.first << " " << i.second;
+		file << "\n";
+		file.close();
+
+		if (file.fail() || rename(tmppath.c_str(), path.c_str())) {
+			logging::LogPerror("rename()");
+			unlink(tmppath.c_str());
+		}
+		file.clear();
+	}
+}
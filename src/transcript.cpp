@@ -0,0 +1,183 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "logging.h"
+#include "probe_cache.h"
+#include "transcript.h"
+#include "utils.h"
+
+#define MAGIC "smoketest-transcript 1"
+
+/* Descriptor of the transcript being recorded, shared by all the workers. */
+static int recordfd = -1;
+/* Commands already recorded by the current process. */
+static std::unordered_set<std::string> recorded;
+
+/* Whether the results are replayed from a transcript. */
+static bool replaying = false;
+/* Map the commands in the transcript being replayed to their results. */
+static std::unordered_map<std::string, utils::ProbeResult> results;
+
+/*
+ * Returns the key identifying "command" in a transcript. Unlike the
+ * key of the probe cache (see utils::ProbeKey()), it doesn't include
+ * the environment, which is the same for all the commands of a run.
+ */
+static std::string
+TranscriptKey(const std::vector<std::string>& command)
+{
+	std::string key;
+
+	for (const auto &i : command) {
+		key += i;
+		key.push_back('\0');
+	}
+
+	return key;
+}
+
+/*
+ * Starts recording the results of all the commands requested during
+ * this run of the tool to the transcript "path", which is created (or
+ * truncated). As with the probe report, the descriptor is opened in
+ * append mode before the workers are forked.
+ */
+bool
+transcript::Record(std::string path)
+{
+	std::string header = std::string(MAGIC) + "\n";
+
+	recordfd = open(path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (recordfd == -1) {
+		logging::LogPerror("open()");
+		return false;
+	}
+	if (write(recordfd, header.data(), header.size()) == -1) {
+		logging::LogPerror("write()");
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Loads the transcript "path", from which the results of the commands
+ * are taken hereafter instead of executing them (see Lookup()).
+ */
+bool
+transcript::Replay(std::string path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	std::string magic;
+	std::string key;
+	utils::ProbeResult output;
+
+	if (!file.is_open()) {
+		logging::LogPerror("open()");
+		return false;
+	}
+	if (!std::getline(file, magic) || magic != MAGIC)
+		return false;
+
+	while (file.peek() != EOF) {
+		if (!probecache::Read(file, key, output))
+			return false;
+		results[key] = output;
+		output = utils::ProbeResult();
+	}
+	replaying = true;
+
+	return true;
+}
+
+bool
+transcript::Replaying()
+{
+	return replaying;
+}
+
+/*
+ * Records the result "output" of "command" in the transcript, unless
+ * it has already been recorded.
+ */
+void
+transcript::Append(const std::vector<std::string>& command,
+		   const utils::ProbeResult& output)
+{
+	std::ostringstream record;
+	std::string key;
+	std::string data;
+
+	if (recordfd == -1 ||
+	    !recorded.insert(key = TranscriptKey(command)).second)
+		return;
+
+	probecache::Write(record, key, output);
+	data = record.str();
+	/* A single write(2) keeps the records of the workers apart. */
+	if (write(recordfd, data.data(), data.size()) != (ssize_t)data.size())
+		logging::LogPerror("write()");
+}
+
+/*
+ * Returns the result of "command" from the transcript being replayed.
+ * A command missing in the transcript is reported as having timed out,
+ * so that no testcase is generated from it.
+ */
+utils::ProbeResult
+transcript::Lookup(const std::vector<std::string>& command)
+{
+	std::unordered_map<std::string, utils::ProbeResult>::iterator it;
+	utils::ProbeResult missing;
+
+	if ((it = results.find(TranscriptKey(command))) != results.end())
+		return it->second;
+
+	DEBUGP("Not in transcript: %s\n", utils::CommandString(command).c_str());
+	missing.timedout = true;
+	return missing;
+}
+
+void
+transcript::Close()
+{
+	if (recordfd != -1) {
+		close(recordfd);
+		recordfd = -1;
+	}
+}
@@ -26,157 +26,271 @@
  * $FreeBSD$
  */
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#ifdef __FreeBSD__
+#include <sys/procctl.h>
+#elif defined(__linux__)
+#include <sys/prctl.h>
+#endif
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <paths.h>
 #include <signal.h>
+#include <spawn.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <boost/algorithm/string/trim.hpp>
 #include <cstdlib>
-#include <fstream>
 #include <iostream>
+#include <unordered_set>
 
 #include "utils.h"
+#include "coprocess.h"
+#include "executor.h"
+#include "failfast.h"
 #include "fetch_groff.h"
+#include "known_options.h"
 #include "logging.h"
+#include "mdoc.h"
+#include "option_index.h"
+#include "prescreen.h"
+#include "probe_cache.h"
+#include "probe_report.h"
+#include "timing.h"
+#include "transcript.h"
+#include "zygote.h"
 
 #define READ 0  	/* Pipe descriptor: read end. */
 #define WRITE 1 	/* Pipe descriptor: write end. */
+/* Default threshold (milliseconds) for a command to complete its execution. */
+#define TIMEOUT 1000
+/* Default grace period (milliseconds) between SIGTERM and SIGKILL. */
+#define GRACE 500
+/* Default number of bytes retained from each output stream of a command. */
+#define MAX_OUTPUT (64 * 1024)
+/* Size of the memory files capturing the output streams (see OpenChannel()). */
+#define MEMFD_LIMIT (16 * 1024 * 1024)
+/* Fraction of the full budget given to the commands of interactive utilities. */
+#define INTERACTIVE_SHARE 4
+
+const char *utils::tmpdir = "tmpdir";
+std::string utils::workdir = utils::tmpdir;
+std::string utils::fixture;
+std::vector<std::string> utils::environment;
+long utils::timeout = TIMEOUT;
+long utils::grace = GRACE;
+size_t utils::max_output = MAX_OUTPUT;
+bool utils::memfd_capture = false;
+size_t utils::memfd_limit = MEMFD_LIMIT;
+
+/*
+ * Outputs and exit statuses of the commands executed so far, keyed by
+ * ProbeKey(). Every distinct command is hence executed only once.
+ */
+static std::unordered_map<std::string, utils::ProbeResult> probe_cache;
 /*
- * Buffer size (used for buffering output generated
- * after executing the utility-specific command).
+ * Results of "<utility> --help" of the utilities probed by ProbeHelp(),
+ * keyed by the utility.
  */
-#define BUFSIZE 128
-#define TIMEOUT 1 	/* Threshold (seconds) for a function call to return. */
+static std::unordered_map<std::string, utils::ProbeResult> help_results;
+/*
+ * Collects the long options mentioned in "text", the usage message of
+ * a utility, into "options". An option is described by the line it is
+ * mentioned on. Mentions at the very start of "text" and lines merely
+ * repeating "--help" are ignored, as utilities such as echo(1) or
+ * yes(1) print their arguments back rather than a usage message.
+ */
+static void
+HelpOptions(const std::string& text, std::vector<mdoc::Option>& options)
+{
+	boost::string_view view(text);
+	mdoc::Option option;
+	size_t pos = 0;
+	size_t end;
+	size_t bol;
+	size_t eol;
+
+	while ((pos = text.find("--", pos)) != std::string::npos) {
+		end = pos + 2;
+		/* Skip e.g. "illegal option -- -" and "`--help'". */
+		if (!pos || text[pos - 1] == '\0' ||
+		    !strchr(" \t[(|,", text[pos - 1]) ||
+		    end == text.size() || !isalnum((unsigned char)text[end])) {
+			pos = end;
+			continue;
+		}
+		while (end < text.size() &&
+		       (isalnum((unsigned char)text[end]) ||
+			text[end] == '-' || text[end] == '_'))
+			end++;
+
+		bol = text.rfind('\n', pos);
+		bol = (bol == std::string::npos) ? 0 : bol + 1;
+		if ((eol = text.find('\n', pos)) == std::string::npos)
+			eol = text.size();
+		if (boost::algorithm::trim_copy(text.substr(bol, eol - bol))
+		    == "--help") {
+			pos = end;
+			continue;
+		}
+		option = mdoc::Option();
+		option.name = text.substr(pos + 1, end - pos - 1);
+		option.description = view.substr(bol, eol - bol);
+		options.push_back(option);
+		pos = end;
+	}
+}
 
-const char *utils::tmpdir = "tmpdir";
 /*
- * Insert a list of user-defined option definitions
- * into a hashmap. These specific option definitions
- * are the ones which one can be easily tested.
+ * Executes "<utility> --help" for all the "utilities" at once (see
+ * ExecuteBatch()), with at most "max_children" commands running
+ * concurrently, so that CheckOpts() needn't wait for the usage message
+ * of each utility in turn.
  */
 void
-utils::OptDefinition::InsertOpts()
+utils::ProbeHelp(const std::vector<std::string>& utilities,
+		 size_t max_children)
 {
-	/* Option definitions. */
-	OptRelation h_def;        /* '-h' */
-	h_def.type    = 's';
-	h_def.value   = "h";
-	h_def.keyword = "help";
-
-	OptRelation v_def;        /* '-v' */
-	v_def.type    = 's';
-	v_def.value   = "v";
-	v_def.keyword = "version";
-
-	/*
-	 * "opt_map" contains all the options
-	 * which can be easily tested.
-	 */
-	opt_map.insert(std::make_pair<std::string, OptRelation>
-		      ("h", (OptRelation)h_def));
-	opt_map.insert(std::make_pair<std::string, OptRelation>
-		      ("v", (OptRelation)v_def));
-};
+	std::vector<std::vector<std::string>> commands;
+	std::vector<ProbeResult> outputs;
+	size_t i;
+
+	for (const auto &i : utilities)
+		commands.push_back(GenerateCommand(i, "-help"));
+	outputs = ExecuteBatch(commands, max_children);
+	for (i = 0; i < utilities.size(); i++)
+		help_results[utilities[i]] = std::move(outputs[i]);
+}
 
 /*
  * For the utility under test, find the supported options
- * present in the hashmap generated by InsertOpts()
- * and return them in a form of list of option relations.
+ * the semantics of which are known (see the file
+ * "known_options"), and return them in a form of list of
+ * option relations, which are kept in "opt_map".
+ * The options are taken from the model of the utility's
+ * man page (see mdoc::Parse()), followed by the long
+ * options only mentioned in its usage message (if it was
+ * obtained by ProbeHelp()). An option
+ * is identified if its description mentions a keyword of
+ * one of its known semantics, while the remaining options
+ * are collected in "opt_list". A long option is named
+ * after its leading "--" minus a '-', e.g. "-help" (see
+ * GenerateCommand()).
  */
 std::vector<utils::OptRelation *>
 utils::OptDefinition::CheckOpts(std::string utility)
 {
-	std::string opt_id = ".It Fl";  /* Option identifier in man page. */
-	std::string line;        /* An individual line in a man-page. */
-	std::string opt_name;    /* Name of the option. */
-	std::string buffer;      /* Option description extracted from man-page. */
-	std::string opt_string;  /* Identified option names. */
-	int opt_pos;        /* Starting index of the (identified) option. */
-	int space_index;         /* First occurrence of space in option definition. */
 	std::vector<OptRelation *> identified_opts;
-	std::vector<std::string> supported_sections = { "1", "8" };
+	std::vector<mdoc::Option> help_opts;
+	std::unordered_set<std::string> names;
+	std::unordered_map<std::string, ProbeResult>::iterator help;
+	mdoc::Page page;
+	OptRelation relation;
+	const char *semantic;
 
-	/* Generate the hashmap "opt_map". */
-	InsertOpts();
-	std::ifstream infile(groff::groff_map[utility]);
+	if (!optindex::Parse(utility, groff::groff_map[utility], page))
+		return identified_opts;
 
 	/*
-	 * Search for all the options accepted by the
-	 * utility and collect those present in "opt_map".
+	 * The result of "--help" is memoized again, hence it isn't
+	 * executed anew if the option is also probed along with the others.
 	 */
-	while (std::getline(infile, line)) {
-		if ((opt_pos = line.find(opt_id)) != std::string::npos) {
-			/* Locate the position of option name. */
-			opt_pos += opt_id.size() + 1;
-			if (opt_pos > line.size()) {
-				/*
-				 * This condition will trigger when a utility
-				 * supports an empty argument, e.g. tset(issue #9)
-				 */
-				continue;
-			}
-
-			/*
-			 * Check for long options ; While here, also sanitize
-			 * multi-word option definitions in a man page to properly
-			 * extract short options from option definitions such as:
-			 * 	.It Fl r Ar seconds (taken from date(1)).
-			 */
-			if ((space_index = line.find(" ", opt_pos + 1, 1))
-					!= std::string::npos)
-				opt_name = line.substr(opt_pos, space_index - opt_pos);
-			else
-				opt_name = line.substr(opt_pos);
-
-			/*
-			 * Check if the identified option matches the identifier.
-			 * "opt_list.back()" is the previously checked option, the
-			 * description of which is now stored in "buffer".
-			 */
-			if (!opt_list.empty() &&
-			   (opt_map_iter = opt_map.find(opt_list.back()))
-					!= opt_map.end() &&
-			    buffer.find((opt_map_iter->second).keyword) != std::string::npos) {
-				identified_opts.push_back(&(opt_map_iter->second));
-				/*
-				 * Since the usage of the option under test
-				 * is known, we remove it from "opt_list".
-				 */
-				opt_list.pop_back();
-			}
+	if ((help = help_results.find(utility)) != help_results.end()) {
+		probe_cache[ProbeKey(GenerateCommand(utility, "-help"))] =
+		    help->second;
+		HelpOptions(help->second.out, help_opts);
+		HelpOptions(help->second.err, help_opts);
+	}
+	for (const auto &i : page.options)
+		names.insert(i.name);
+	for (auto &i : help_opts) {
+		if (names.insert(i.name).second)
+			page.options.push_back(std::move(i));
+	}
 
-			/* Update the list of valid options. */
-			opt_list.push_back(opt_name);
-			/* Empty the buffer for next option's description. */
-			buffer.clear();
+	for (const auto &i : page.options) {
+		if ((semantic = knownopts::Identify(i.name, i.description))
+				!= NULL) {
+			relation.type = (i.name.size() > 1 && i.name[0] == '-') ?
+					'l' : 's';
+			relation.value = i.name;
+			relation.keyword = semantic;
+			identified_opts.push_back(&(opt_map[i.name] = relation));
 		} else {
-			/*
-			 * Collect the option description until next
-			 * valid option definition is encountered.
-			 */
-			buffer.append(line);
+			/* The usage of the option is not yet known. */
+			opt_list.push_back(i.name);
 		}
 	}
 
 	return identified_opts;
 }
 
-/* Generates command for execution. */
-std::string
+/*
+ * Generates command (argument vector) for execution, with the
+ * option "opt" prefixed by a '-' (i.e. "--name" for a long option).
+ */
+std::vector<std::string>
 utils::GenerateCommand(std::string utility, std::string opt)
 {
-	std::string command = utility;
+	std::vector<std::string> command(1, utility);
 
 	if (!opt.empty())
-		command += " -" + opt;
-	command += " 2>&1 </dev/null";
+		command.push_back("-" + opt);
 
 	return command;
 }
 
+/* Generates a printable representation of "command". */
+std::string
+utils::CommandString(const std::vector<std::string>& command)
+{
+	std::string str;
+
+	for (const auto &i : command) {
+		if (!str.empty())
+			str.push_back(' ');
+		str += i;
+	}
+
+	return str;
+}
+
+/*
+ * Creates the channel for an output stream of a child, i.e. a pipe, or
+ * an anonymous memory file (both the ends of which refer to the same
+ * file) if "memfd_capture" is set.
+ * Unlike a pipe, a memory file isn't drained while the child runs, hence
+ * it's sized to "memfd_limit" up front and sealed against growing, so
+ * that the writes of a chatty child beyond the limit fail instead of
+ * exhausting the memory. Since both the ends share the file offset, the
+ * offset tells how much was written (see executor::Executor::Collect()).
+ */
+static int
+OpenChannel(int fds[2])
+{
+	if (!utils::memfd_capture)
+		return pipe2(fds, O_CLOEXEC);
+
+	if ((fds[READ] = memfd_create("smoketest",
+	    MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1)
+		return -1;
+	if (ftruncate(fds[READ], utils::memfd_limit) == -1 ||
+	    fcntl(fds[READ], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1 ||
+	    (fds[WRITE] = fcntl(fds[READ], F_DUPFD_CLOEXEC, 0)) == -1) {
+		close(fds[READ]);
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * When pclose() is called on the stream returned by popen(),
  * it waits indefinitely for the created shell process to
@@ -184,153 +298,390 @@ utils::GenerateCommand(std::string utility, std::string opt)
  * user input via a blocking read (e.g. passwd(1)).
  * Hence, we define a custom function which alongside
  * returning the read-write file descriptors, also returns
- * the pid of the newly created (child) shell process. This
+ * the pid of the newly created (child) process. This
  * pid can later be used for sending a signal to the child.
  *
- * NOTE For the sake of completeness, we also specify actions
- * to be taken corresponding to the "w" (write) type. However,
- * in this context only the "r" (read) type will be required.
+ * Unlike popen(), the utility is executed directly (without an
+ * intermediate shell) with the argument vector "command". Its
+ * stdout and stderr are redirected to separate pipes (or memory
+ * files, see OpenChannel()), and its stdin is redirected from
+ * /dev/null. The utility is executed inside the directory "dir"
+ * (if not empty), which is changed to on the child's side,
+ * leaving the parent's cwd untouched.
+ * If the zygote is running, the utility is spawned by it.
+ * Returns NULL with errno set to ENOENT if the utility could
+ * not be found.
  */
-
 utils::PipeDescriptor*
-utils::POpen(const char *command)
+utils::Spawn(const std::vector<std::string>& command, const std::string& dir)
 {
 	int pdes[2];
-	char *argv[4];
+	int edes[2];
+	int error;
+	std::string path;
 	pid_t child_pid;
-	PipeDescriptor *pipe_descr = (PipeDescriptor *)malloc(sizeof(PipeDescriptor));
+	PipeDescriptor *pipe_descr;
+
+	if (command.empty() ||
+	    (path = utils::LookupUtility(command.front())).empty()) {
+		errno = ENOENT;
+		return NULL;
+	}
 
 	/* Create a pipe with ~
 	 *   - pdes[READ]: read end
 	 *   - pdes[WRITE]: write end
 	 */
-	if (pipe2(pdes, O_CLOEXEC) < 0)
+	if (OpenChannel(pdes) < 0)
 		return NULL;
-
-	pipe_descr->readfd = pdes[READ];
-	pipe_descr->writefd = pdes[WRITE];
-
-	/* Type-cast to avoid compiler warnings [-Wwrite-strings]. */
-	argv[0] = (char *)"sh";
-	argv[1] = (char *)"-c";
-	argv[2] = (char *)command;
-	argv[3] = NULL;
-
-	switch (child_pid = vfork()) {
-	case -1: 		/* Error. */
-		free(pipe_descr);
+	if (OpenChannel(edes) < 0) {
 		close(pdes[READ]);
 		close(pdes[WRITE]);
 		return NULL;
-	case 0: 		/* Child. */
-		/*
-		 * TODO Verify if the following operations on both read
-		 * and write file-descriptors (irrespective of the value
-		 * of 'type', which is no longer being used) is safe.
-		 */
-		if (pdes[WRITE] != STDOUT_FILENO)
-			dup2(pdes[WRITE], STDOUT_FILENO);
-		else
-			fcntl(pdes[WRITE], F_SETFD, 0);
-		if (pdes[READ] != STDIN_FILENO)
-			dup2(pdes[READ], STDIN_FILENO);
-		else
-			fcntl(pdes[READ], F_SETFD, 0);
-
-		/*
-		 * For current usecase, it might so happen that the child gets
-		 * stuck on a blocking read (e.g. passwd(1)) waiting for user
-		 * input. In that case the child will be killed via a signal.
-		 * To avoid any effect on the parent's execution, we place the
-		 * child in a separate process group with pgid set as "child_pid".
-		 */
-		setpgid(child_pid, child_pid);
-		execve("/bin/sh", argv, NULL);
-		exit(127);
 	}
 
+	if (zygote::Running())
+		error = zygote::Spawn(&child_pid, path, command, environment,
+				      dir, pdes[WRITE], edes[WRITE]);
+	else
+		error = SpawnProcess(&child_pid, path, command, environment,
+				     dir, pdes[WRITE], edes[WRITE]);
+
+	/* Close the unrequired file-descriptors. */
+	close(pdes[WRITE]);
+	close(edes[WRITE]);
+	if (error) {
+		close(pdes[READ]);
+		close(edes[READ]);
+		errno = error;
+		return NULL;
+	}
+
+	pipe_descr = (PipeDescriptor *)malloc(sizeof(PipeDescriptor));
+	pipe_descr->outfd = pdes[READ];
+	pipe_descr->errfd = edes[READ];
 	pipe_descr->pid = child_pid;
 	return pipe_descr;
 }
 
 /*
- * Executes the command passed as argument in a
- * shell and returns its output and exit status.
+ * Spawns the utility "path" with the argument vector "command" and the
+ * environment "env" inside the directory "dir" (if not empty), with its
+ * stdout and stderr redirected to "outfd" and "errfd" respectively.
+ * Returns 0 on success, or an error number (see posix_spawn(3)).
  */
-std::pair<std::string, int>
-utils::Execute(std::string command)
+int
+utils::SpawnProcess(pid_t *pid,
+		    const std::string& path,
+		    const std::vector<std::string>& command,
+		    const std::vector<std::string>& env,
+		    const std::string& dir,
+		    int outfd,
+		    int errfd)
+{
+	std::vector<char *> argv;
+	std::vector<char *> envp;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int error;
+
+	/* Type-cast to avoid compiler warnings [-Wwrite-strings]. */
+	for (const auto &i : command)
+		argv.push_back((char *)i.c_str());
+	argv.push_back(NULL);
+	for (const auto &i : env)
+		envp.push_back((char *)i.c_str());
+	envp.push_back(NULL);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, errfd, STDERR_FILENO);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+					 O_RDONLY, 0);
+	if (!dir.empty())
+		posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+
+	/*
+	 * For current usecase, it might so happen that the child gets
+	 * stuck on a blocking read (e.g. passwd(1)) waiting for user
+	 * input. In that case the child will be killed via a signal.
+	 * To avoid any effect on the parent's execution, we place the
+	 * child in a separate process group with pgid set as "child_pid".
+	 */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+
+	error = posix_spawn(pid, path.c_str(), &actions, &attr,
+			    argv.data(), envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	return error;
+}
+
+/*
+ * Makes the current process the reaper of its descendants, i.e. the
+ * descendants orphaned by the exit of their parents are reparented to
+ * the current process instead of init(8). This ensures that the
+ * processes left behind by a command can still be found and killed
+ * (see KillStrays()).
+ */
+void
+utils::AcquireReaper()
+{
+#ifdef __FreeBSD__
+	if (procctl(P_PID, getpid(), PROC_REAP_ACQUIRE, NULL) == -1 &&
+	    errno != EBUSY)
+		logging::LogPerror("procctl()");
+#elif defined(__linux__)
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
+		logging::LogPerror("prctl()");
+#endif
+}
+
+/*
+ * Kills the processes left behind by the exited child "pid", i.e. the
+ * remaining members of its process group and, on FreeBSD, also all of
+ * its descendants which have left the process group (e.g. daemons).
+ */
+void
+utils::KillStrays(pid_t pid)
+{
+#ifdef __FreeBSD__
+	struct procctl_reaper_kill rk;
+
+	memset(&rk, 0, sizeof(rk));
+	rk.rk_sig = SIGKILL;
+	rk.rk_flags = REAPER_KILL_SUBTREE;
+	rk.rk_subtree = pid;
+	procctl(P_PID, getpid(), PROC_REAP_KILL, &rk);
+#endif
+	kill(-pid, SIGKILL);
+}
+
+/*
+ * Reaps the orphaned descendants which were reparented to the current
+ * process (see AcquireReaper()) and have exited since.
+ */
+void
+utils::ReapStrays()
 {
-	int result;
-	int exitstatus;
-	std::array<char, BUFSIZE> buffer;
-	std::string usage_output;
-	struct timeval tv;
-	fd_set readfds;
-	FILE *pipe;
-	PipeDescriptor *pipe_descr;
 	pid_t pid;
-	int pstat;
 
-	/* Execute "command" inside "tmpdir". */
-	chdir(tmpdir);
-	pipe_descr = utils::POpen(command.c_str());
-	chdir("..");
+	do {
+		pid = waitpid(WAIT_ANY, NULL, WNOHANG);
+	} while (pid > 0 || (pid == -1 && errno == EINTR));
+}
 
-	if (pipe_descr == NULL) {
-		logging::LogPerror("utils::POpen()");
-		exit(EXIT_FAILURE);
+/*
+ * Generates the key identifying the result of executing "command", i.e.
+ * the command itself along with the environment it is executed in.
+ */
+std::string
+utils::ProbeKey(const std::vector<std::string>& command)
+{
+	std::string key;
+
+	for (const auto &i : command) {
+		key += i;
+		key.push_back('\0');
+	}
+	for (const auto &i : environment) {
+		key.push_back('\0');
+		key += i;
 	}
 
-	/* Close the unrequired file-descriptor. */
-	close(pipe_descr->writefd);
+	return key;
+}
 
-	pipe = fdopen(pipe_descr->readfd, "r");
-	free(pipe_descr);
-	if (pipe == NULL) {
-		close(pipe_descr->readfd);
-		logging::LogPerror("fdopen()");
-		exit(EXIT_FAILURE);
+/*
+ * Locates the binary of "utility" in the directories listed in PATH
+ * of "environment", or the default search path of the shell if PATH
+ * is not set. Returns an empty string if the binary could not be found.
+ */
+std::string
+utils::LookupUtility(std::string utility)
+{
+	std::string path = _PATH_DEFPATH;
+	std::string candidate;
+	size_t start = 0;
+	size_t end;
+	struct stat sb;
+
+	if (utility.find('/') != std::string::npos)
+		return utility;
+
+	for (const auto &i : environment) {
+		if (!i.compare(0, 5, "PATH="))
+			path = i.substr(5);
 	}
 
-	/* Set a timeout for shell process to complete its execution. */
-	tv.tv_sec = TIMEOUT;
-	tv.tv_usec = 0;
+	do {
+		end = path.find(':', start);
+		candidate = path.substr(start, end - start) + "/" + utility;
+		if (!stat(candidate.c_str(), &sb) && S_ISREG(sb.st_mode))
+			return candidate;
+		start = end + 1;
+	} while (end != std::string::npos);
+
+	return "";
+}
+
+/* Computes the 64-bit FNV-1a hash of "len" bytes starting at "data". */
+uint64_t
+utils::Hash(const char *data, size_t len, uint64_t hash)
+{
+	while (len--) {
+		hash ^= (unsigned char)*data++;
+		hash *= 0x100000001b3ULL;
+	}
 
-	FD_ZERO(&readfds);
-	FD_SET(fileno(pipe), &readfds);
-	result = select(fileno(pipe) + 1, &readfds, NULL, NULL, &tv);
+	return hash;
+}
 
-	if (result > 0) {
-		while (!feof(pipe) && !ferror(pipe)) {
-			if (fgets(buffer.data(), BUFSIZE, pipe) != NULL)
-				usage_output += buffer.data();
+/*
+ * Computes the hash of the contents of the file located at "path".
+ * A nonexistent file hashes the same as an empty one.
+ */
+uint64_t
+utils::HashFile(std::string path, uint64_t hash)
+{
+	std::array<char, 8192> buffer;
+	ssize_t nread;
+	int fd;
+
+	if (path.empty() || (fd = open(path.c_str(), O_RDONLY)) == -1)
+		return hash;
+
+	while ((nread = read(fd, buffer.data(), buffer.size())) > 0)
+		hash = utils::Hash(buffer.data(), nread, hash);
+
+	close(fd);
+	return hash;
+}
+
+/* Forgets the results of the commands executed so far. */
+void
+utils::ClearProbeCache()
+{
+	probe_cache.clear();
+}
+
+/*
+ * Executes the command passed as argument in a
+ * shell and returns the result of its execution.
+ */
+utils::ProbeResult
+utils::Execute(std::string command)
+{
+	std::vector<std::string> argv = { "sh", "-c", command };
+
+	return utils::Execute(argv);
+}
+
+/* Executes "command" and returns the result of its execution. */
+utils::ProbeResult
+utils::Execute(const std::vector<std::string>& command)
+{
+	return utils::ExecuteBatch
+		(std::vector<std::vector<std::string>>(1, command), 1).front();
+}
+
+/*
+ * Executes the commands passed as argument, each in a separate process,
+ * with at most "max_children" of them running at any given time (see
+ * executor::Executor). The results are returned in the order of
+ * "commands".
+ * Commands which were already executed (or appear more than once) are
+ * not executed again; their memoized results are returned instead. The
+ * results are also persisted across runs via the probe cache.
+ * Each command is given the budget learned for its utility (see
+ * timing::Budget()), and is executed again with the full budget if it
+ * runs out of the learned one, unless it is known to be stuck. The
+ * commands of the utilities which are likely to be waiting for user
+ * input (see prescreen::Interactive()) are given a fraction of the
+ * full budget at most, which is final.
+ * When replaying a transcript, the results are taken from it instead,
+ * and no command is executed.
+ */
+std::vector<utils::ProbeResult>
+utils::ExecuteBatch(const std::vector<std::vector<std::string>>& commands,
+		    size_t max_children)
+{
+	std::vector<ProbeResult> outputs(commands.size());
+	std::vector<std::string> keys(commands.size());
+	std::vector<long> budgets(commands.size());
+	/* Map "key" to the index of the first command having that key. */
+	std::unordered_map<std::string, size_t> scheduled;
+	std::unordered_map<std::string, size_t>::iterator first;
+	std::unordered_map<std::string, ProbeResult>::iterator hit;
+	executor::Executor executor(max_children);
+	std::vector<size_t> shell;  /* Commands for the shell coprocess. */
+	ProbeResult output;
+	size_t i;
+	auto complete = [&](size_t index, ProbeResult& output) {
+		if (output.timedout && budgets[index] < utils::timeout &&
+		    !timing::Stuck(commands[index].front(), keys[index]) &&
+		    !prescreen::Interactive(commands[index].front())) {
+			budgets[index] = utils::timeout;
+			executor.Submit(index, commands[index], budgets[index]);
+			return;
 		}
-	} else if (result == -1) {
-		logging::LogPerror("select()");
-		if (kill(pipe_descr->pid, SIGTERM) < 0)
-			logging::LogPerror("kill()");
-	} else if (result == 0) {
-		/*
-		 * We gave a relaxed value of TIMEOUT seconds for the shell process
-		 * to complete it's execution. If at this point it is still
-		 * alive, it (most probably) is stuck on a blocking read
-		 * waiting for the user input. Since a few of the utilities
-		 * performing such blocking reads don't respond to SIGINT
-		 * (e.g. pax(1)), we terminate the shell process via SIGTERM.
-		 */
-		if (kill(pipe_descr->pid, SIGTERM) < 0)
-			logging::LogPerror("kill()");
+		failfast::Classify(commands[index].front(), output);
+		timing::Record(commands[index].front(), keys[index], output,
+			       budgets[index]);
+		outputs[index] = output;
+		probe_cache[keys[index]] = output;
+		probecache::Store(keys[index], commands[index].front(), output);
+		probereport::Record(commands[index], output);
+	};
+
+	if (transcript::Replaying()) {
+		for (i = 0; i < commands.size(); i++)
+			outputs[i] = transcript::Lookup(commands[i]);
+		return outputs;
 	}
 
-	/* Retrieve exit status of the shell process. */
-	do {
-		pid = wait4(pipe_descr->pid, &pstat, 0, (struct rusage *)0);
-	} while (pid == -1 && errno == EINTR);
+	for (i = 0; i < commands.size(); i++) {
+		keys[i] = utils::ProbeKey(commands[i]);
+		if ((hit = probe_cache.find(keys[i])) != probe_cache.end())
+			outputs[i] = hit->second;
+		else if (probecache::Lookup(keys[i], commands[i].front(),
+					    outputs[i]))
+			probe_cache[keys[i]] = outputs[i];
+		else if (scheduled.find(keys[i]) == scheduled.end()) {
+			scheduled[keys[i]] = i;
+			if (coprocess::enabled && commands[i].size() == 3 &&
+			    commands[i][0] == "sh" && commands[i][1] == "-c") {
+				budgets[i] = utils::timeout;
+				shell.push_back(i);
+			} else {
+				budgets[i] = timing::Budget(commands[i].front(),
+							    keys[i]);
+				if (prescreen::Interactive(commands[i].front()))
+					budgets[i] = std::min(budgets[i],
+					    std::max(utils::timeout /
+						     INTERACTIVE_SHARE, 1L));
+				executor.Submit(i, commands[i], budgets[i]);
+			}
+		}
+	}
 
-	fclose(pipe);
-	exitstatus = (pid == -1) ? -1 : WEXITSTATUS(pstat);
-	DEBUGP("Command: %s, exit status: %d\n", command.c_str(), exitstatus);
+	executor.Run(complete);
+	for (const auto &index : shell) {
+		output = coprocess::Execute(commands[index][2], budgets[index]);
+		complete(index, output);
+	}
+	timing::Flush();
+
+	/* Populate the results of the duplicate commands. */
+	for (i = 0; i < commands.size(); i++) {
+		if ((first = scheduled.find(keys[i])) != scheduled.end() &&
+		    first->second != i)
+			outputs[i] = outputs[first->second];
+		transcript::Append(commands[i], outputs[i]);
+	}
 
-	return std::make_pair<std::string, int>
-		((std::string)usage_output, (int)exitstatus);
+	return outputs;
 }
@@ -29,6 +29,8 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <cstdint>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -40,19 +42,63 @@ namespace utils {
 	struct OptRelation {
 		char type;            /* Option type: (s)short/(l)long. */
 		std::string value;    /* Name of the option. */
-		/* The keyword which should be looked up in usage
-		 * message (if) produced when using this options.
+		/* The known semantic of the option, e.g. "verbose"
+		 * (see the file "known_options").
 		 */
 		std::string keyword;
 	};
 
 	/*
-	 * Read/Write file descriptors for a pipe.
+	 * Read ends of the pipes connected to the
+	 * stdout and stderr of a spawned process.
 	 */
 	struct PipeDescriptor {
-		int readfd;
-		int writefd;
-		pid_t pid;  /* PID of the forked shell process. */
+		int outfd;
+		int errfd;
+		pid_t pid;  /* PID of the spawned process. */
+	};
+
+	/*
+	 * Result of executing a utility-specific command.
+	 */
+	struct ProbeResult {
+		std::string out;      /* Output produced on stdout. */
+		std::string err;      /* Output produced on stderr. */
+		int exitstatus;       /* Exit status (if exited normally). */
+		int termsig;          /* Terminating signal (if killed), or 0. */
+		bool timedout;        /* Whether the deadline was hit. */
+		/* Whether it tried to interact with a terminal (see failfast). */
+		bool interactive;
+		long duration;        /* Wall-clock duration (milliseconds). */
+		/*
+		 * Sizes and digests (see Hash()) of the complete streams.
+		 * Only the first "max_output" bytes of a stream are kept.
+		 */
+		size_t outsize;
+		size_t errsize;
+		uint64_t outdigest;
+		uint64_t errdigest;
+		/* Resource usage of the process (see getrusage(2)). */
+		long utime;           /* User CPU time (milliseconds). */
+		long stime;           /* System CPU time (milliseconds). */
+		long maxrss;          /* Maximum resident set size (KiB). */
+		long minflt;          /* Page reclaims. */
+		long majflt;          /* Page faults. */
+
+		ProbeResult() : exitstatus(0), termsig(0),
+				timedout(false), interactive(false),
+				duration(0),
+				outsize(0), errsize(0),
+				outdigest(0xcbf29ce484222325ULL),
+				errdigest(0xcbf29ce484222325ULL),
+				utime(0), stime(0), maxrss(0),
+				minflt(0), majflt(0) {}
+		/* Whether the command ran to completion with EXIT_SUCCESS. */
+		bool Succeeded() const
+		{
+			return !timedout && !interactive && !termsig &&
+			       !exitstatus;
+		}
 	};
 
 	/*
@@ -63,9 +109,78 @@ namespace utils {
 	 */
 	extern const char *tmpdir;
 
-	std::string GenerateCommand(std::string, std::string);
-	std::pair<std::string, int> Execute(std::string);
-	PipeDescriptor* POpen(const char*);
+	/*
+	 * Scratch directory (inside "tmpdir") of the current worker.
+	 * Each worker generating tests in parallel is assigned its own
+	 * so that the side effects of one utility don't leak into the
+	 * commands of another utility being tested at the same time.
+	 * Every command is in turn executed inside a directory of its
+	 * own within "workdir" (see executor::Executor).
+	 */
+	extern std::string workdir;
+
+	/*
+	 * Directory (absolute path) whose contents are mirrored inside the
+	 * scratch directory of every command, or empty if the commands
+	 * start in an empty directory.
+	 */
+	extern std::string fixture;
+
+	/*
+	 * Environment in which the utility-specific commands
+	 * are executed ("NAME=value" strings).
+	 */
+	extern std::vector<std::string> environment;
+
+	/*
+	 * Wall-clock budget (milliseconds) for a command to complete its
+	 * execution, after which its process group is terminated.
+	 */
+	extern long timeout;
+
+	/*
+	 * Grace period (milliseconds) for a command to exit after being
+	 * sent SIGTERM on hitting its deadline, after which it is killed.
+	 */
+	extern long grace;
+
+	/* Number of bytes of each output stream retained for a command. */
+	extern size_t max_output;
+
+	/*
+	 * Whether the output streams of a command are captured in anonymous
+	 * memory files (see memfd_create(2)), which are mapped once the
+	 * command exits, instead of being read from pipes as they arrive.
+	 */
+	extern bool memfd_capture;
+
+	/*
+	 * Number of bytes of each output stream captured in a memory file,
+	 * beyond which the writes of the command fail. Like with max_output,
+	 * a stream was cut short if its size exceeds the retained output.
+	 */
+	extern size_t memfd_limit;
+
+	std::vector<std::string> GenerateCommand(std::string, std::string);
+	std::string CommandString(const std::vector<std::string>&);
+	std::string ProbeKey(const std::vector<std::string>&);
+	void ClearProbeCache();
+	std::string LookupUtility(std::string);
+	uint64_t Hash(const char *, size_t, uint64_t = 0xcbf29ce484222325ULL);
+	uint64_t HashFile(std::string, uint64_t = 0xcbf29ce484222325ULL);
+	void AcquireReaper();
+	void KillStrays(pid_t);
+	void ReapStrays();
+	ProbeResult Execute(std::string);
+	ProbeResult Execute(const std::vector<std::string>&);
+	std::vector<ProbeResult>
+		ExecuteBatch(const std::vector<std::vector<std::string>>&, size_t);
+	void ProbeHelp(const std::vector<std::string>&, size_t);
+	PipeDescriptor* Spawn(const std::vector<std::string>&, const std::string&);
+	int SpawnProcess(pid_t *, const std::string&,
+			 const std::vector<std::string>&,
+			 const std::vector<std::string>&,
+			 const std::string&, int, int);
 
 	class OptDefinition {
 	public:
@@ -73,9 +188,7 @@ namespace utils {
 		std::vector<std::string> opt_list;
 		/* Map "option value" to "option definition". */
 		std::unordered_map<std::string, OptRelation> opt_map;
-		std::unordered_map<std::string, OptRelation>::iterator opt_map_iter;
 
-		void InsertOpts();
 		std::vector<OptRelation *> CheckOpts(std::string);
 	};
 }
@@ -0,0 +1,526 @@
+/*-
+ * Copyright 2017-2018 Shivansh Rai
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logging.h"
+#include "utils.h"
+#include "zygote.h"
+
+/* Maximum number of descriptors passed along with a message. */
+#define MAXFDS 2
+
+/* Types of the messages sent by the zygote over a channel. */
+enum { SPAWNED, EXITED };
+
+/* Message sent by the zygote over a channel. */
+struct Reply {
+	int type;
+	pid_t pid;
+	int error;         /* Error of posix_spawn(3) (SPAWNED). */
+	int status;        /* Status reported by wait4(2) (EXITED). */
+	struct rusage ru;  /* Resource usage (EXITED). */
+};
+
+/* Header of a spawn request, followed by "len" bytes of strings. */
+struct Request {
+	uint32_t len;
+	uint32_t argc;
+};
+
+/* Socket over which the channels are registered with the zygote. */
+static int server = -1;
+/*
+ * Channel to the zygote of the current process. Since the workers
+ * are forked after the zygote is started, each of them registers a
+ * channel of its own upon its first request (see Channel()).
+ */
+static int channel = -1;
+static pid_t channel_owner = -1;
+/* Exits received while waiting for a reply to a spawn request. */
+static std::deque<zygote::Exit> exits;
+/* [Zygote] SIGCHLD is converted to an event on this pipe. */
+static int sigchld_pipe[2] = { -1, -1 };
+
+static void
+SigchldHandler(int /* signo */)
+{
+	int saved_errno = errno;
+
+	write(sigchld_pipe[1], "", 1);
+	errno = saved_errno;
+}
+
+/* Reads exactly "len" bytes, returning false on EOF or an error. */
+static bool
+ReadFull(int fd, void *buf, size_t len)
+{
+	ssize_t nread;
+
+	while (len) {
+		if ((nread = read(fd, buf, len)) <= 0) {
+			if (nread == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+		buf = (char *)buf + nread;
+		len -= nread;
+	}
+
+	return true;
+}
+
+/*
+ * Sends "len" bytes in a single message, passing the "nfds"
+ * descriptors in "fds" along with it.
+ */
+static bool
+SendMessage(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(MAXFDS * sizeof(int))];
+	ssize_t nwritten;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	do {
+		nwritten = sendmsg(sock, &msg, 0);
+	} while (nwritten == -1 && errno == EINTR);
+
+	return nwritten == (ssize_t)len;
+}
+
+/*
+ * Receives exactly "len" bytes, storing the descriptors passed along
+ * with them in "fds" (at most MAXFDS). Returns the number of received
+ * descriptors, or -1 on EOF or an error.
+ */
+static int
+RecvMessage(int sock, void *buf, size_t len, int *fds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(MAXFDS * sizeof(int))];
+	ssize_t nread;
+	int nfds = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	do {
+		nread = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (nread == -1 && errno == EINTR);
+	if (nread <= 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+	}
+
+	if ((size_t)nread < len &&
+	    !ReadFull(sock, (char *)buf + nread, len - nread)) {
+		while (nfds)
+			close(fds[--nfds]);
+		return -1;
+	}
+
+	return nfds;
+}
+
+/*
+ * [Zygote] Handles a spawn request on "chan", replying with the pid
+ * of the spawned process. Returns false if the channel was closed.
+ */
+static bool
+HandleRequest(int chan, std::unordered_map<pid_t, int>& owners)
+{
+	struct Request request;
+	struct Reply reply;
+	std::vector<std::string> strings;
+	std::vector<std::string> command;
+	std::vector<std::string> env;
+	std::string payload;
+	size_t pos;
+	size_t end;
+	int fds[MAXFDS];
+	int nfds;
+
+	if ((nfds = RecvMessage(chan, &request, sizeof(request), fds)) == -1)
+		return false;
+	payload.resize(request.len);
+	if (nfds != MAXFDS || !ReadFull(chan, &payload[0], request.len)) {
+		while (nfds > 0)
+			close(fds[--nfds]);
+		return false;
+	}
+
+	/* The payload is laid out as "path\0dir\0argv...\0env...\0". */
+	for (pos = 0; pos < payload.size(); pos = end + 1) {
+		if ((end = payload.find('\0', pos)) == std::string::npos)
+			end = payload.size();
+		strings.push_back(payload.substr(pos, end - pos));
+	}
+	if (strings.size() < 2 + request.argc) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	command.assign(strings.begin() + 2, strings.begin() + 2 + request.argc);
+	env.assign(strings.begin() + 2 + request.argc, strings.end());
+
+	memset(&reply, 0, sizeof(reply));
+	reply.type = SPAWNED;
+	reply.error = utils::SpawnProcess(&reply.pid, strings[0], command, env,
+					  strings[1], fds[0], fds[1]);
+	close(fds[0]);
+	close(fds[1]);
+	if (!reply.error)
+		owners[reply.pid] = chan;
+
+	return write(chan, &reply, sizeof(reply)) == sizeof(reply);
+}
+
+/*
+ * [Zygote] Serves the spawn requests received over the registered
+ * channels, and reports the exits of the spawned processes over the
+ * channels they were requested on. Returns once the generator exits.
+ */
+static void
+Serve(int sock)
+{
+	std::unordered_map<pid_t, int> owners;  /* Spawned pid -> channel. */
+	std::unordered_map<pid_t, int>::iterator owner;
+	std::vector<int> channels;
+	std::vector<struct pollfd> pollfds;
+	struct sigaction sa;
+	struct Reply reply;
+	struct rusage ru;
+	siginfo_t si;
+	char byte;
+	int fds[MAXFDS];
+	int chan;
+	int pstat;
+	pid_t pid;
+	size_t i;
+
+	if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+		logging::LogPerror("pipe2()");
+		return;
+	}
+	sa.sa_handler = SigchldHandler;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+	utils::AcquireReaper();
+
+	for (;;) {
+		pollfds.clear();
+		pollfds.push_back({ sock, POLLIN, 0 });
+		pollfds.push_back({ sigchld_pipe[0], POLLIN, 0 });
+		for (const auto &i : channels)
+			pollfds.push_back({ i, POLLIN, 0 });
+
+		if (poll(pollfds.data(), pollfds.size(), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			logging::LogPerror("poll()");
+			return;
+		}
+
+		/* A new channel is registered, or the generator has exited. */
+		if (pollfds[0].revents) {
+			if (RecvMessage(sock, &byte, 1, fds) != 1)
+				return;
+			channels.push_back(fds[0]);
+		}
+
+		for (i = pollfds.size() - 1; i >= 2; i--) {
+			if (!pollfds[i].revents)
+				continue;
+			chan = pollfds[i].fd;
+			if (HandleRequest(chan, owners))
+				continue;
+			/* The worker owning the channel has exited. */
+			close(chan);
+			channels.erase(channels.begin() + (i - 2));
+			for (owner = owners.begin(); owner != owners.end(); ) {
+				if (owner->second == chan)
+					owner = owners.erase(owner);
+				else
+					++owner;
+			}
+		}
+
+		if (pollfds[1].revents) {
+			while (read(sigchld_pipe[0], &byte, 1) > 0)
+				;
+			/*
+			 * Orphaned descendants are reaped here too. The strays
+			 * of a child are killed before reaping it, while its
+			 * pid can't be reused.
+			 */
+			for (;;) {
+				memset(&si, 0, sizeof(si));
+				if (waitid(P_ALL, 0, &si,
+				    WEXITED | WNOHANG | WNOWAIT) == -1 ||
+				    (pid = si.si_pid) == 0)
+					break;
+				owner = owners.find(pid);
+				if (owner != owners.end())
+					utils::KillStrays(pid);
+				if (wait4(pid, &pstat, 0, &ru) == -1 ||
+				    owner == owners.end())
+					continue;
+				memset(&reply, 0, sizeof(reply));
+				reply.type = EXITED;
+				reply.pid = pid;
+				reply.status = pstat;
+				reply.ru = ru;
+				write(owner->second, &reply, sizeof(reply));
+				owners.erase(owner);
+			}
+		}
+	}
+}
+
+/*
+ * Starts the zygote, i.e. a small process forked while the generator's
+ * own footprint is still small, which spawns the utilities on behalf of
+ * the generator (and its workers).
+ */
+bool
+zygote::Start()
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		logging::LogPerror("socketpair()");
+		return false;
+	}
+
+	switch (pid = fork()) {
+	case -1:
+		logging::LogPerror("fork()");
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	case 0:
+		close(sv[0]);
+		/* The generator takes care of the cleanup on interrupts. */
+		signal(SIGINT, SIG_IGN);
+		Serve(sv[1]);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(sv[1]);
+	server = sv[0];
+	return true;
+}
+
+/* Whether the utilities are being spawned via the zygote. */
+bool
+zygote::Running()
+{
+	return server != -1;
+}
+
+/*
+ * Returns the channel to the zygote of the current process, creating
+ * and registering it if needed. Returns -1 on failure.
+ */
+int
+zygote::Channel()
+{
+	int sv[2];
+
+	if (channel_owner == getpid())
+		return channel;
+
+	/* Channel inherited from the parent (if any). */
+	if (channel != -1)
+		close(channel);
+	exits.clear();
+	channel = -1;
+	channel_owner = getpid();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		logging::LogPerror("socketpair()");
+		return -1;
+	}
+	if (!SendMessage(server, "", 1, &sv[1], 1)) {
+		logging::LogPerror("sendmsg()");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	close(sv[1]);
+
+	return channel = sv[0];
+}
+
+/*
+ * Spawns the utility "path" via the zygote (see utils::SpawnProcess()).
+ * Returns 0 on success, or an error number.
+ */
+int
+zygote::Spawn(pid_t *pid,
+	      const std::string& path,
+	      const std::vector<std::string>& command,
+	      const std::vector<std::string>& env,
+	      const std::string& dir,
+	      int outfd,
+	      int errfd)
+{
+	struct Request request;
+	struct Reply reply;
+	zygote::Exit done;
+	std::string message;
+	std::string cwd;
+	char buf[PATH_MAX];
+	int fds[MAXFDS] = { outfd, errfd };
+	int chan;
+
+	if ((chan = Channel()) == -1)
+		return EPIPE;
+
+	/* The zygote resolves relative paths against its own cwd. */
+	if (getcwd(buf, sizeof(buf)) != NULL)
+		cwd = std::string(buf) + "/";
+
+	message.append((char *)&request, sizeof(request));
+	message += (path[0] == '/' ? "" : cwd) + path;
+	message.push_back('\0');
+	message += (dir.empty() || dir[0] == '/' ? "" : cwd) + dir;
+	message.push_back('\0');
+	for (const auto &i : command) {
+		message += i;
+		message.push_back('\0');
+	}
+	for (const auto &i : env) {
+		message += i;
+		message.push_back('\0');
+	}
+	request.len = message.size() - sizeof(request);
+	request.argc = command.size();
+	memcpy(&message[0], &request, sizeof(request));
+
+	if (!SendMessage(chan, message.data(), message.size(), fds, MAXFDS))
+		return EPIPE;
+
+	/* Exits of the earlier spawned processes may arrive meanwhile. */
+	for (;;) {
+		if (!ReadFull(chan, &reply, sizeof(reply)))
+			return EPIPE;
+		if (reply.type == SPAWNED)
+			break;
+		done.pid = reply.pid;
+		done.status = reply.status;
+		done.ru = reply.ru;
+		exits.push_back(done);
+	}
+
+	*pid = reply.pid;
+	return reply.error;
+}
+
+/*
+ * Retrieves the next exit of a process spawned by the current process
+ * without blocking. Returns false if there is none.
+ */
+bool
+zygote::NextExit(Exit& exit)
+{
+	struct pollfd pfd;
+	struct Reply reply;
+
+	if (!exits.empty()) {
+		exit = exits.front();
+		exits.pop_front();
+		return true;
+	}
+
+	pfd.fd = Channel();
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) == 1) {
+		if (!ReadFull(pfd.fd, &reply, sizeof(reply)))
+			return false;
+		if (reply.type != EXITED)
+			continue;
+		exit.pid = reply.pid;
+		exit.status = reply.status;
+		exit.ru = reply.ru;
+		return true;
+	}
+
+	return false;
+}